@@ -9,7 +9,9 @@
 #define BOOST_ASIO_BASIC_DIR_MONITOR_HPP
 
 #include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <string>
+#include <vector>
 
 namespace boost {
 namespace asio {
@@ -49,31 +51,70 @@ public:
 
     void add_directory(const std::string &dirname)
     {
-        this->service.add_directory(this->implementation, dirname);
+        this->get_service().add_directory(this->get_implementation(), dirname);
+    }
+
+    // Watch dirname and every directory below it, including ones created
+    // later.
+    void add_directory_recursive(const std::string &dirname)
+    {
+        this->get_service().add_directory(this->get_implementation(), dirname, true);
     }
 
     void remove_directory(const std::string &dirname)
     {
-        this->service.remove_directory(this->implementation, dirname);
+        this->get_service().remove_directory(this->get_implementation(), dirname);
+    }
+
+    // Modifications of a file are held back for the window so that a burst of
+    // writes is reported as one event. The default window is zero, in which
+    // case only modifications which are still queued are merged.
+    void set_coalesce_window(boost::posix_time::time_duration window)
+    {
+        this->get_service().set_coalesce_window(this->get_implementation(), window);
     }
 
+    // With inotify, a monitor is waited on either with monitor() or with
+    // async_monitor() and async_monitor_batch(), whichever is used first. The
+    // other kind of wait then fails with
+    // boost::asio::error::operation_not_supported.
+    //
+    // With inotify, a wait fails with boost::asio::error::no_buffer_space if
+    // events were lost because the kernel's queue overflowed. The monitor
+    // keeps working, but the watched directories should be rescanned. A
+    // watched directory which is moved is no longer watched, unless it is
+    // moved into a directory which is watched recursively.
     dir_monitor_event monitor()
     {
         boost::system::error_code ec;
-        dir_monitor_event ev = this->service.monitor(this->implementation, ec);
+        dir_monitor_event ev = this->get_service().monitor(this->get_implementation(), ec);
         boost::asio::detail::throw_error(ec);
         return ev;
     }
 
     dir_monitor_event monitor(boost::system::error_code &ec)
     {
-        return this->service.monitor(this->implementation, ec);
+        return this->get_service().monitor(this->get_implementation(), ec);
     }
 
+    // With inotify, once a monitor has been waited on asynchronously it keeps
+    // a read pending on the io_service, so io_service::run() only returns
+    // after io_service::stop() or after the monitor is destroyed. A monitor
+    // which is waited on with monitor() doesn't need the io_service to be
+    // run. See monitor() for mixing the two kinds of wait.
     template <typename Handler>
     void async_monitor(Handler handler)
     {
-        this->service.async_monitor(this->implementation, handler);
+        this->get_service().async_monitor(this->get_implementation(), handler);
+    }
+
+    // Wait for events and append all of those which are queued to events in
+    // one go. The handler is called with the number of events appended.
+    // events must stay valid until the handler is called.
+    template <typename Handler>
+    void async_monitor_batch(std::vector<dir_monitor_event> &events, Handler handler)
+    {
+        this->get_service().async_monitor_batch(this->get_implementation(), events, handler);
     }
 };
 
@@ -0,0 +1,214 @@
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef BOOST_ASIO_DIR_MONITOR_EVENT_QUEUE_HPP
+#define BOOST_ASIO_DIR_MONITOR_EVENT_QUEUE_HPP
+
+#include "basic_dir_monitor.hpp"
+#include <boost/thread.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/system/error_code.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/unordered_map.hpp>
+#include <algorithm>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace boost {
+namespace asio {
+
+// Queue of events waiting to be picked up by monitor() or async_monitor().
+//
+// Modifications of a file which is already waiting to be reported as modified
+// are merged into the queued event, and a modification is held back for the
+// coalescing window so that a burst of writes is reported once. Any other
+// event for the same file releases a held modification first so events for a
+// single file are never reordered.
+class dir_monitor_event_queue
+{
+public:
+    dir_monitor_event_queue()
+        : run_(true),
+        coalesce_window_(boost::posix_time::milliseconds(0)),
+        next_seq_(0)
+    {
+    }
+
+    void set_coalesce_window(boost::posix_time::time_duration window)
+    {
+        boost::unique_lock<boost::mutex> lock(events_mutex_);
+        coalesce_window_ = window;
+    }
+
+    void destroy()
+    {
+        boost::unique_lock<boost::mutex> lock(events_mutex_);
+        run_ = false;
+        events_cond_.notify_all();
+    }
+
+    dir_monitor_event popfront_event(boost::system::error_code &ec)
+    {
+        boost::unique_lock<boost::mutex> lock(events_mutex_);
+        for (;;)
+        {
+            while (run_ && events_.empty())
+                events_cond_.wait(lock);
+            if (events_.empty())
+            {
+                ec = boost::asio::error::operation_aborted;
+                return dir_monitor_event();
+            }
+
+            // Take the first event which isn't being held back.
+            boost::system_time now = boost::get_system_time();
+            boost::system_time next_due = events_.front().due;
+            for (std::deque<queued_event>::iterator it = events_.begin(); it != events_.end(); ++it)
+            {
+                if (!run_ || it->due <= now)
+                {
+                    ec = boost::system::error_code();
+                    dir_monitor_event ev = it->event;
+                    erase(it);
+                    return ev;
+                }
+                if (it->due < next_due)
+                    next_due = it->due;
+            }
+            events_cond_.timed_wait(lock, next_due);
+        }
+    }
+
+    // Move every event which isn't being held back to the end of evs without
+    // waiting. Returns the number of events moved.
+    std::size_t popfront_events(std::vector<dir_monitor_event> &evs)
+    {
+        boost::unique_lock<boost::mutex> lock(events_mutex_);
+        boost::system_time now = boost::get_system_time();
+        std::size_t count = 0;
+        // Held events are moved down over the taken ones in a single pass,
+        // which keeps them in order, and the leftovers are erased at the end.
+        std::deque<queued_event>::iterator kept = events_.begin();
+        for (std::deque<queued_event>::iterator it = events_.begin(); it != events_.end(); ++it)
+        {
+            if (run_ && it->due > now)
+            {
+                if (kept != it)
+                    *kept = std::move(*it);
+                ++kept;
+                continue;
+            }
+            forget(*it);
+            evs.push_back(std::move(it->event));
+            ++count;
+        }
+        events_.erase(kept, events_.end());
+        return count;
+    }
+
+    void pushback_event(dir_monitor_event ev)
+    {
+        boost::unique_lock<boost::mutex> lock(events_mutex_);
+        if (!run_)
+            return;
+
+        push(ev, boost::get_system_time());
+        events_cond_.notify_all();
+    }
+
+    // Queue a batch of events under a single lock.
+    void pushback_events(const std::vector<dir_monitor_event> &evs)
+    {
+        if (evs.empty())
+            return;
+
+        boost::unique_lock<boost::mutex> lock(events_mutex_);
+        if (!run_)
+            return;
+
+        boost::system_time now = boost::get_system_time();
+        for (std::vector<dir_monitor_event>::const_iterator it = evs.begin(); it != evs.end(); ++it)
+            push(*it, now);
+        events_cond_.notify_all();
+    }
+
+private:
+    struct queued_event
+    {
+        dir_monitor_event event;
+        boost::system_time due;
+        boost::uint64_t seq;
+    };
+
+    struct last_event
+    {
+        boost::uint64_t seq;
+        dir_monitor_event::event_type type;
+    };
+
+    static bool seq_less(const queued_event &qe, boost::uint64_t seq)
+    {
+        return qe.seq < seq;
+    }
+
+    static std::string key(const dir_monitor_event &ev)
+    {
+        return ev.dirname + '/' + ev.filename;
+    }
+
+    void push(const dir_monitor_event &ev, boost::system_time now)
+    {
+        // The last queued event for each file is indexed so that merging
+        // doesn't have to search the queue.
+        std::pair<last_events_t::iterator, bool> last = last_events_.insert(last_events_t::value_type(key(ev), last_event()));
+        if (!last.second && last.first->second.type == dir_monitor_event::modified)
+        {
+            if (ev.type == dir_monitor_event::modified)
+                return;
+
+            // The queue is sorted by sequence number.
+            std::deque<queued_event>::iterator it = std::lower_bound(events_.begin(), events_.end(), last.first->second.seq, seq_less);
+            if (it != events_.end() && it->seq == last.first->second.seq)
+                it->due = now;
+        }
+
+        queued_event qe = { ev, now, next_seq_++ };
+        if (ev.type == dir_monitor_event::modified)
+            qe.due += coalesce_window_;
+        events_.push_back(qe);
+        last.first->second.seq = qe.seq;
+        last.first->second.type = ev.type;
+    }
+
+    // Stop merging into qe, which is about to leave the queue.
+    void forget(const queued_event &qe)
+    {
+        last_events_t::iterator last = last_events_.find(key(qe.event));
+        if (last != last_events_.end() && last->second.seq == qe.seq)
+            last_events_.erase(last);
+    }
+
+    std::deque<queued_event>::iterator erase(std::deque<queued_event>::iterator it)
+    {
+        forget(*it);
+        return events_.erase(it);
+    }
+
+    boost::mutex events_mutex_;
+    boost::condition_variable events_cond_;
+    bool run_;
+    boost::posix_time::time_duration coalesce_window_;
+    std::deque<queued_event> events_;
+    boost::uint64_t next_seq_;
+    typedef boost::unordered_map<std::string, last_event> last_events_t;
+    last_events_t last_events_;
+};
+
+}
+}
+
+#endif
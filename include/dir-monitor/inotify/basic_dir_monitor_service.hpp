@@ -10,19 +10,19 @@
 
 #include "dir_monitor_impl.hpp"
 #include <boost/asio.hpp>
-#include <boost/thread.hpp>
-#include <boost/bind.hpp>
 #include <boost/shared_ptr.hpp>
-#include <boost/weak_ptr.hpp>
-#include <boost/scoped_ptr.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/system/error_code.hpp>
 #include <string>
+#include <vector>
 #include <stdexcept>
 
 namespace boost {
 namespace asio {
 
+// The implementation reads its inotify descriptor either on the io_service of
+// the monitor or on the thread calling monitor(), so unlike the Windows
+// service no threads are started here.
 template <typename DirMonitorImplementation = dir_monitor_impl>
 class basic_dir_monitor_service
     : public boost::asio::io_service::service
@@ -32,35 +32,15 @@ public:
 
     explicit basic_dir_monitor_service(boost::asio::io_service &io_service)
         : boost::asio::io_service::service(io_service),
-        async_monitor_work_(new boost::asio::io_service::work(async_monitor_io_service_)),
-        async_monitor_thread_(boost::bind(&boost::asio::io_service::run, &async_monitor_io_service_))
+        io_service_(io_service)
     {
     }
 
-    ~basic_dir_monitor_service()
-    {
-        // The async_monitor thread will finish when async_monitor_work_ is reset as all asynchronous
-        // operations have been aborted and were discarded before (in destroy).
-        async_monitor_work_.reset();
-
-        // Event processing is stopped to discard queued operations.
-        async_monitor_io_service_.stop();
-
-        // The async_monitor thread is joined to make sure the directory monitor service is
-        // destroyed _after_ the thread is finished (not that the thread tries to access
-        // instance properties which don't exist anymore).
-        async_monitor_thread_.join();
-    }
-
     typedef boost::shared_ptr<DirMonitorImplementation> implementation_type;
 
     void construct(implementation_type &impl)
     {
-        impl.reset(new DirMonitorImplementation());
-
-        // begin_read() can't be called within the constructor but must be called
-        // explicitly as it calls shared_from_this().
-        impl->begin_read();
+        impl.reset(new DirMonitorImplementation(io_service_));
     }
 
     void destroy(implementation_type &impl)
@@ -72,12 +52,12 @@ public:
         impl.reset();
     }
 
-    void add_directory(implementation_type &impl, const std::string &dirname)
+    void add_directory(implementation_type &impl, const std::string &dirname, bool recursive = false)
     {
         if (!boost::filesystem::is_directory(dirname))
             throw std::invalid_argument("boost::asio::basic_dir_monitor_service::add_directory: " + dirname + " is not a valid directory entry");
 
-        impl->add_directory(dirname);
+        impl->add_directory(dirname, recursive);
     }
 
     void remove_directory(implementation_type &impl, const std::string &dirname)
@@ -85,49 +65,26 @@ public:
         impl->remove_directory(dirname);
     }
 
+    void set_coalesce_window(implementation_type &impl, boost::posix_time::time_duration window)
+    {
+        impl->set_coalesce_window(window);
+    }
+
     dir_monitor_event monitor(implementation_type &impl, boost::system::error_code &ec)
     {
         return impl->popfront_event(ec);
     }
 
     template <typename Handler>
-    class monitor_operation
+    void async_monitor(implementation_type &impl, Handler handler)
     {
-    public:
-        monitor_operation(implementation_type &impl, boost::asio::io_service &io_service, Handler handler)
-            : impl_(impl),
-            io_service_(io_service),
-            work_(io_service),
-            handler_(handler)
-        {
-        }
-
-        void operator()() const
-        {
-            implementation_type impl = impl_.lock();
-            if (impl)
-            {
-                boost::system::error_code ec;
-                dir_monitor_event ev = impl->popfront_event(ec);
-                this->io_service_.post(boost::asio::detail::bind_handler(handler_, ec, ev));
-            }
-            else
-            {
-                this->io_service_.post(boost::asio::detail::bind_handler(handler_, boost::asio::error::operation_aborted, dir_monitor_event()));
-            }
-        }
-
-    private:
-        boost::weak_ptr<DirMonitorImplementation> impl_;
-        boost::asio::io_service &io_service_;
-        boost::asio::io_service::work work_;
-        Handler handler_;
-    };
+        impl->async_monitor(handler);
+    }
 
     template <typename Handler>
-    void async_monitor(implementation_type &impl, Handler handler)
+    void async_monitor_batch(implementation_type &impl, std::vector<dir_monitor_event> &events, Handler handler)
     {
-        this->async_monitor_io_service_.post(monitor_operation<Handler>(impl, this->get_io_service(), handler));
+        impl->async_monitor_batch(events, handler);
     }
 
 private:
@@ -135,9 +92,7 @@ private:
     {
     }
 
-    boost::asio::io_service async_monitor_io_service_;
-    boost::scoped_ptr<boost::asio::io_service::work> async_monitor_work_;
-    boost::thread async_monitor_thread_;
+    boost::asio::io_service &io_service_;
 };
 
 template <typename DirMonitorImplementation>
@@ -8,96 +8,209 @@
 #ifndef BOOST_ASIO_DIR_MONITOR_IMPL_HPP
 #define BOOST_ASIO_DIR_MONITOR_IMPL_HPP
 
+#include "../basic_dir_monitor.hpp"
 #include <boost/enable_shared_from_this.hpp>
 #include <boost/asio.hpp>
+#include <boost/atomic.hpp>
 #include <boost/thread.hpp>
 #include <boost/bind.hpp>
-#include <boost/scoped_ptr.hpp>
+#include <boost/function.hpp>
 #include <boost/array.hpp>
-#include <boost/bimap.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/system/system_error.hpp>
 #include <string>
 #include <deque>
+#include <list>
+#include <utility>
+#include <vector>
+#include <cstring>
 #include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <unistd.h>
 #include <errno.h>
 
 namespace boost {
 namespace asio {
 
+// A monitor doesn't need any threads of its own. How the inotify descriptor is
+// read depends on how the monitor is first waited on:
+//
+// - After async_monitor() or async_monitor_batch(), the descriptor is read on
+//   the io_service which owns the monitor, and everything on the reading side
+//   runs in strand_. A read stays pending from then on, so io_service::run()
+//   only returns after io_service::stop() or after the monitor is destroyed.
+//   Calling monitor() on such a monitor fails with operation_not_supported.
+// - With only monitor(), the descriptor is read on the thread which calls
+//   monitor(), which also does the work of the reading side. The io_service
+//   doesn't have to be run at all. Calling async_monitor() on such a monitor
+//   fails with operation_not_supported.
+//
+// Decoded events are handed to the consumer through a single producer single
+// consumer lock-free queue. There is only ever one consumer: strand_ in the
+// first case, and the thread in monitor() in the second. If the kernel's queue overflows, a null event is
+// queued after the events before the overflow, and the consumer reports it as
+// no_buffer_space.
+//
+// A directory which is moved is no longer watched, as its watch would report
+// it under its old name. If it is moved into a recursively watched directory
+// it is watched again under its new name.
+//
+// Modifications of a file are held back for the coalescing window, and merged
+// while they are held, so that a burst of writes is reported once. With no
+// window, modifications are only merged within a single read from the
+// descriptor. Any other event for the same file releases a held modification
+// first so events for a single file are never reordered.
 class dir_monitor_impl :
     public boost::enable_shared_from_this<dir_monitor_impl>
 {
+    struct watch
+    {
+        std::string dirname;
+        bool recursive;
+    };
+
+    struct watch_map
+    {
+        typedef boost::unordered_map<int, watch> by_wd_t;
+        typedef boost::unordered_map<std::string, int> by_dirname_t;
+        by_wd_t by_wd;
+        by_dirname_t by_dirname;
+    };
+
 public:
-    dir_monitor_impl()
+    typedef boost::function<void (const boost::system::error_code&, const dir_monitor_event&)> handler_type;
+    typedef boost::function<void (const boost::system::error_code&, std::size_t)> batch_handler_type;
+
+    explicit dir_monitor_impl(boost::asio::io_service &io_service)
         : fd_(init_fd()),
-        stream_descriptor_(inotify_io_service_, fd_),
-        inotify_work_(new boost::asio::io_service::work(inotify_io_service_)),
-        inotify_work_thread_(boost::bind(&boost::asio::io_service::run, &inotify_io_service_)),
-        run_(true)
+        io_service_(io_service),
+        strand_(io_service),
+        stream_descriptor_(io_service, fd_),
+        coalesce_timer_(io_service),
+        timer_armed_(false),
+        reading_(false),
+        read_buffer_size_(0),
+        events_(event_queue_capacity),
+        backlog_size_(0),
+        run_(true),
+        mode_(unset_mode),
+        coalesce_window_us_(0),
+        overflow_pending_(false),
+        wake_fd_(init_wake_fd()),
+        watches_(new watch_map())
     {
     }
 
-    void add_directory(const std::string &dirname)
+    ~dir_monitor_impl()
     {
-        int wd = inotify_add_watch(fd_, dirname.c_str(), IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO);
-        if (wd == -1)
+        ::close(wake_fd_);
+    }
+
+    void add_directory(const std::string &dirname, bool recursive)
+    {
+        boost::unique_lock<boost::mutex> lock(watches_mutex_);
+        boost::shared_ptr<watch_map> watches(new watch_map(*watches_));
+        if (!add_watch(*watches, dirname, recursive))
         {
-            boost::system::system_error e(boost::system::error_code(errno, boost::system::get_system_category()), "boost::asio::dir_monitor_impl::add_directory: inotify_add_watch failed");
+            boost::system::system_error e(boost::system::error_code(errno, boost::system::system_category()), "boost::asio::dir_monitor_impl::add_directory: inotify_add_watch failed");
             boost::throw_exception(e);
         }
 
-        boost::unique_lock<boost::mutex> lock(watch_descriptors_mutex_);
-        watch_descriptors_.insert(watch_descriptors_t::value_type(wd, dirname));
+        // Each directory is watched before it is listed so that subdirectories
+        // created meanwhile aren't missed. Subdirectories may also be removed
+        // meanwhile, so don't fail if they can't be watched.
+        if (recursive)
+        {
+            std::vector<std::string> dirs;
+            list_directory(dirname, dirs, 0);
+            for (std::size_t i = 0; i < dirs.size(); ++i)
+            {
+                if (add_watch(*watches, dirs[i], true))
+                    list_directory(dirs[i], dirs, 0);
+            }
+        }
+        boost::atomic_store(&watches_, boost::shared_ptr<const watch_map>(watches));
     }
 
     void remove_directory(const std::string &dirname)
     {
-        boost::unique_lock<boost::mutex> lock(watch_descriptors_mutex_);
-        watch_descriptors_t::right_map::iterator it = watch_descriptors_.right.find(dirname);
-        if (it != watch_descriptors_.right.end())
+        boost::unique_lock<boost::mutex> lock(watches_mutex_);
+        watch_map::by_dirname_t::const_iterator it = watches_->by_dirname.find(dirname);
+        if (it == watches_->by_dirname.end())
+            return;
+
+        std::vector<int> wds(1, it->second);
+        // Remove the directories which were added along with a recursive watch.
+        if (watches_->by_wd.find(it->second)->second.recursive)
+        {
+            std::string prefix = dirname + '/';
+            for (watch_map::by_wd_t::const_iterator w = watches_->by_wd.begin(); w != watches_->by_wd.end(); ++w)
+            {
+                if (w->second.recursive && w->second.dirname.compare(0, prefix.size(), prefix) == 0)
+                    wds.push_back(w->first);
+            }
+        }
+
+        boost::shared_ptr<watch_map> watches(new watch_map(*watches_));
+        for (std::vector<int>::iterator wd = wds.begin(); wd != wds.end(); ++wd)
         {
-            inotify_rm_watch(fd_, it->second);
-            watch_descriptors_.right.erase(it);
+            inotify_rm_watch(fd_, *wd);
+            remove_watch(*watches, *wd);
         }
+        boost::atomic_store(&watches_, boost::shared_ptr<const watch_map>(watches));
     }
 
     void destroy()
     {
-        inotify_work_.reset();
-        inotify_io_service_.stop();
-        inotify_work_thread_.join();
-
-        boost::unique_lock<boost::mutex> lock(events_mutex_);
         run_ = false;
-        events_cond_.notify_all();
+        // Wake up a monitor() blocked in poll().
+        eventfd_write(wake_fd_, 1);
+        strand_.dispatch(boost::bind(&dir_monitor_impl::do_destroy, shared_from_this()));
+    }
+
+    void set_coalesce_window(boost::posix_time::time_duration window)
+    {
+        coalesce_window_us_ = window.total_microseconds();
     }
 
     dir_monitor_event popfront_event(boost::system::error_code &ec)
     {
-        boost::unique_lock<boost::mutex> lock(events_mutex_);
-        while (run_ && events_.empty())
-            events_cond_.wait(lock);
-        dir_monitor_event ev;
-        if (!events_.empty())
-        {
-            ec = boost::system::error_code();
-            ev = events_.front();
-            events_.pop_front();
-        }
-        else
-            ec = boost::asio::error::operation_aborted;
-        return ev;
+        int mode = unset_mode;
+        mode_.compare_exchange_strong(mode, sync_mode);
+        if (mode != async_mode)
+            return read_event(ec);
+
+        // The events are consumed in strand_, which monitor() can't join.
+        ec = boost::asio::error::operation_not_supported;
+        return dir_monitor_event();
     }
 
-    void pushback_event(dir_monitor_event ev)
+    void async_monitor(handler_type handler)
     {
-        boost::unique_lock<boost::mutex> lock(events_mutex_);
-        if (run_)
-        {
-            events_.push_back(ev);
-            events_cond_.notify_all();
-        }
+        int mode = unset_mode;
+        mode_.compare_exchange_strong(mode, async_mode);
+        pending_operation op;
+        op.handler = handler;
+        op.events = 0;
+        strand_.dispatch(boost::bind(&dir_monitor_impl::do_async_monitor, shared_from_this(), op));
+    }
+
+    void async_monitor_batch(std::vector<dir_monitor_event> &events, batch_handler_type handler)
+    {
+        int mode = unset_mode;
+        mode_.compare_exchange_strong(mode, async_mode);
+        pending_operation op;
+        op.batch_handler = handler;
+        op.events = &events;
+        strand_.dispatch(boost::bind(&dir_monitor_impl::do_async_monitor, shared_from_this(), op));
     }
 
 private:
@@ -106,71 +219,637 @@ private:
         int fd = inotify_init();
         if (fd == -1)
         {
-            boost::system::system_error e(boost::system::error_code(errno, boost::system::get_system_category()), "boost::asio::dir_monitor_impl::init_fd: init_inotify failed");
+            boost::system::system_error e(boost::system::error_code(errno, boost::system::system_category()), "boost::asio::dir_monitor_impl::init_fd: init_inotify failed");
+            boost::throw_exception(e);
+        }
+        return fd;
+    }
+
+    int init_wake_fd()
+    {
+        int fd = eventfd(0, EFD_CLOEXEC);
+        if (fd == -1)
+        {
+            boost::system::system_error e(boost::system::error_code(errno, boost::system::system_category()), "boost::asio::dir_monitor_impl::init_wake_fd: eventfd failed");
             boost::throw_exception(e);
         }
         return fd;
     }
 
-public:
     void begin_read()
     {
-        stream_descriptor_.async_read_some(boost::asio::buffer(read_buffer_),
-            boost::bind(&dir_monitor_impl::end_read, shared_from_this(),
-            boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+        stream_descriptor_.async_read_some(boost::asio::buffer(read_buffer_.data() + read_buffer_size_, read_buffer_.size() - read_buffer_size_),
+            strand_.wrap(boost::bind(&dir_monitor_impl::end_read, shared_from_this(),
+            boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
     }
 
-private:
     void end_read(const boost::system::error_code &ec, std::size_t bytes_transferred)
     {
-        if (!ec)
+        if (!run_)
+            return;
+
+        if (ec)
+        {
+            read_error_ = ec;
+            abort_pending(ec);
+            return;
+        }
+
+        read_buffer_size_ += bytes_transferred;
+        decode_events();
+        begin_read();
+    }
+
+    // monitor() on a monitor which isn't read on the io_service. The calling
+    // thread reads the descriptor itself, and does the work which is otherwise
+    // done in strand_. Concurrent calls take turns.
+    dir_monitor_event read_event(boost::system::error_code &ec)
+    {
+        boost::unique_lock<boost::mutex> lock(sync_read_mutex_);
+        dir_monitor_event ev;
+        for (;;)
+        {
+            boost::system_time now = boost::get_system_time();
+            release_held(now);
+            if (pop_event(ev, ec))
+                return ev;
+            if (!run_)
+            {
+                ec = boost::asio::error::operation_aborted;
+                return ev;
+            }
+
+            // Wait for events, or until the first held modification is due.
+            int timeout = -1;
+            if (!held_.empty())
+                timeout = static_cast<int>(std::max<boost::int64_t>((held_.front().due - now).total_milliseconds() + 1, 0));
+            pollfd fds[2] = { { fd_, POLLIN, 0 }, { wake_fd_, POLLIN, 0 } };
+            if (::poll(fds, 2, timeout) == -1)
+            {
+                if (errno == EINTR)
+                    continue;
+                ec = boost::system::error_code(errno, boost::system::system_category());
+                return ev;
+            }
+            if (!(fds[0].revents & POLLIN))
+                continue;
+
+            ssize_t bytes = ::read(fd_, read_buffer_.data() + read_buffer_size_, read_buffer_.size() - read_buffer_size_);
+            if (bytes == -1)
+            {
+                if (errno == EINTR || errno == EAGAIN)
+                    continue;
+                ec = boost::system::error_code(errno, boost::system::system_category());
+                return ev;
+            }
+            read_buffer_size_ += bytes;
+            decode_events();
+        }
+    }
+
+    void decode_events()
+    {
+        // Decode every complete event in the buffer. The kernel only returns
+        // whole events, but nothing is lost if it ever returns part of one.
+        boost::system_time now = boost::get_system_time();
+        std::size_t offset = 0;
+        boost::shared_ptr<const watch_map> watches = boost::atomic_load(&watches_);
+        int last_wd = -1;
+        const watch *last_watch = 0;
+        while (read_buffer_size_ - offset >= sizeof(inotify_event))
+        {
+            inotify_event iev;
+            std::memcpy(&iev, read_buffer_.data() + offset, sizeof(inotify_event));
+            std::size_t event_size = sizeof(inotify_event) + iev.len;
+            if (read_buffer_size_ - offset < event_size)
+                break;
+
+            // Events come in runs from the same directory.
+            if (iev.wd != last_wd)
+            {
+                last_wd = iev.wd;
+                watch_map::by_wd_t::const_iterator it = watches->by_wd.find(iev.wd);
+                last_watch = it != watches->by_wd.end() ? &it->second : 0;
+            }
+
+            // Events were lost. Everything before the overflow is delivered
+            // first, including held modifications.
+            if (iev.mask & IN_Q_OVERFLOW)
+            {
+                release_held(boost::system_time(boost::posix_time::pos_infin));
+                dir_monitor_event overflow;
+                deliver(overflow);
+                offset += event_size;
+                continue;
+            }
+
+            // The watch is gone, either because it was removed or because its
+            // directory was.
+            if (iev.mask & IN_IGNORED)
+            {
+                if (last_watch)
+                    ignored_wds_.push_back(iev.wd);
+                offset += event_size;
+                continue;
+            }
+
+            // Events still queued for a watch which was dropped.
+            if (!last_watch)
+            {
+                offset += event_size;
+                continue;
+            }
+
+            // A watched directory was moved. If its parent is watched, it was
+            // already dropped on IN_MOVED_FROM.
+            if (iev.mask & IN_MOVE_SELF)
+            {
+                drop_watches(std::string(last_watch->dirname));
+                watches = boost::atomic_load(&watches_);
+                last_wd = -1;
+                offset += event_size;
+                continue;
+            }
+
+            dir_monitor_event::event_type type = dir_monitor_event::null;
+            // The mask can carry flags such as IN_ISDIR along with the event.
+            if (iev.mask & IN_CREATE)
+                type = dir_monitor_event::added;
+            else if (iev.mask & IN_DELETE)
+                type = dir_monitor_event::removed;
+            else if (iev.mask & IN_MOVED_FROM)
+                type = dir_monitor_event::renamed_old_name;
+            else if (iev.mask & IN_MOVED_TO)
+                type = dir_monitor_event::renamed_new_name;
+            else if (iev.mask & (IN_MODIFY | IN_CLOSE_WRITE))
+                type = dir_monitor_event::modified;
+            // Null events mark overflows, so don't queue anything else as one.
+            if (type == dir_monitor_event::null)
+            {
+                offset += event_size;
+                continue;
+            }
+
+            // The name is padded with nulls.
+            const char *name = read_buffer_.data() + offset + sizeof(inotify_event);
+            std::size_t name_size = iev.len ? strnlen(name, iev.len) : 0;
+            dir_monitor_event ev;
+            ev.dirname = last_watch->dirname;
+            ev.filename.assign(name, name_size);
+            ev.type = type;
+
+            if (last_watch->recursive && (iev.mask & IN_ISDIR) && (iev.mask & (IN_CREATE | IN_MOVED_TO)))
+                new_dirs_.push_back(ev.dirname + '/' + ev.filename);
+
+            // Drop the watches under a directory which was moved away, so
+            // that later events for it aren't reported under the old name.
+            if ((iev.mask & IN_ISDIR) && (iev.mask & IN_MOVED_FROM))
+            {
+                drop_watches(ev.dirname + '/' + ev.filename);
+                watches = boost::atomic_load(&watches_);
+                last_wd = -1;
+            }
+
+            queue_event(ev, now);
+
+            offset += event_size;
+        }
+
+        // Keep a partial event at the front of the buffer for the next read.
+        read_buffer_size_ -= offset;
+        if (read_buffer_size_ > 0 && offset > 0)
+            std::memmove(read_buffer_.data(), read_buffer_.data() + offset, read_buffer_size_);
+
+        if (!ignored_wds_.empty() || !new_dirs_.empty())
+            update_watches(now);
+
+        release_held(now);
+        complete_pending();
+    }
+
+    // Producer side. Called in strand_.
+
+    // Takes the strings of ev.
+    void queue_event(dir_monitor_event &ev, boost::system_time now)
+    {
+        held_index_t::iterator h = held_index_.find(key(ev));
+        if (ev.type == dir_monitor_event::modified)
+        {
+            if (h != held_index_.end())
+                return;
+            held_.push_back(held_event());
+            held_.back().event = std::move(ev);
+            held_.back().due = now + coalesce_window();
+            held_index_.insert(held_index_t::value_type(key(held_.back().event), --held_.end()));
+            return;
+        }
+
+        if (h != held_index_.end())
+        {
+            // The key points into the held event, so it goes first.
+            std::list<held_event>::iterator held = h->second;
+            held_index_.erase(h);
+            deliver(held->event);
+            held_.erase(held);
+        }
+        deliver(ev);
+    }
+
+    void release_held(boost::system_time now)
+    {
+        while (!held_.empty() && held_.front().due <= now)
+        {
+            held_index_.erase(key(held_.front().event));
+            deliver(held_.front().event);
+            held_.pop_front();
+        }
+
+        // monitor() waits for held modifications by itself.
+        if (!held_.empty() && !timer_armed_ && mode_ == async_mode)
+        {
+            timer_armed_ = true;
+            coalesce_timer_.expires_at(held_.front().due);
+            coalesce_timer_.async_wait(strand_.wrap(boost::bind(&dir_monitor_impl::on_coalesce_timer, shared_from_this(),
+                boost::asio::placeholders::error)));
+        }
+    }
+
+    void on_coalesce_timer(const boost::system::error_code &ec)
+    {
+        timer_armed_ = false;
+        if (ec || !run_)
+            return;
+        release_held(boost::get_system_time());
+        complete_pending();
+    }
+
+    // Hand an event to the consumer, taking its strings. Events which don't
+    // fit in the queue wait in backlog_ until the consumer makes room.
+    void deliver(dir_monitor_event &ev)
+    {
+        if (backlog_.empty() && events_.push(queued_event(ev)))
+            return;
+        backlog_.push_back(std::move(ev));
+        ++backlog_size_;
+    }
+
+    void flush_backlog()
+    {
+        while (!backlog_.empty() && events_.push(queued_event(backlog_.front())))
+        {
+            backlog_.pop_front();
+            --backlog_size_;
+        }
+        complete_pending();
+    }
+
+    // Consumer side.
+
+    // Pop an event, or the overflow error. The error is reported once, in order
+    // with the events.
+    bool pop_event(dir_monitor_event &ev, boost::system::error_code &ec)
+    {
+        if (overflow_pending_)
+        {
+            overflow_pending_ = false;
+            ev = dir_monitor_event();
+            ec = boost::asio::error::no_buffer_space;
+            return true;
+        }
+        if (!events_.consume_one(move_event_to(ev)))
+            return false;
+        if (backlog_size_ > 0)
+        {
+            if (mode_ == sync_mode)
+                flush_backlog();
+            else
+                strand_.post(boost::bind(&dir_monitor_impl::flush_backlog, shared_from_this()));
+        }
+        if (ev.type == dir_monitor_event::null)
+            ec = boost::asio::error::no_buffer_space;
+        else
+            ec = boost::system::error_code();
+        return true;
+    }
+
+    // An async_monitor() or async_monitor_batch() waiting for events.
+    struct pending_operation
+    {
+        handler_type handler;
+        batch_handler_type batch_handler;
+        std::vector<dir_monitor_event> *events;
+    };
+
+    // Complete op if there are events for it.
+    bool try_complete(pending_operation &op)
+    {
+        dir_monitor_event ev;
+        boost::system::error_code ec;
+        if (!op.events)
         {
-            pending_read_buffer_ += std::string(read_buffer_.data(), bytes_transferred);
-            while (pending_read_buffer_.size() > sizeof(inotify_event))
+            if (!pop_event(ev, ec))
+                return false;
+            io_service_.post(boost::asio::detail::bind_handler(op.handler, ec, ev));
+            return true;
+        }
+
+        std::size_t count = 0;
+        while (pop_event(ev, ec))
+        {
+            // Hand over the events before an overflow first.
+            if (ec && count > 0)
             {
-                const inotify_event *iev = reinterpret_cast<const inotify_event*>(pending_read_buffer_.data());
-                dir_monitor_event::event_type type = dir_monitor_event::null;
-                switch (iev->mask)
-                {
-                case IN_CREATE: type = dir_monitor_event::added; break;
-                case IN_DELETE: type = dir_monitor_event::removed; break;
-                case IN_MOVED_FROM: type = dir_monitor_event::renamed_old_name; break;
-                case IN_MOVED_TO: type = dir_monitor_event::renamed_new_name; break;
-                }
-                pushback_event(dir_monitor_event(get_dirname(iev->wd), iev->name, type));
-                pending_read_buffer_.erase(0, sizeof(inotify_event) + iev->len);
+                overflow_pending_ = true;
+                break;
             }
+            if (ec)
+            {
+                fail(op, ec);
+                return true;
+            }
+            op.events->push_back(std::move(ev));
+            ++count;
+        }
+        if (count == 0)
+            return false;
+        io_service_.post(boost::asio::detail::bind_handler(op.batch_handler, boost::system::error_code(), count));
+        return true;
+    }
+
+    void fail(pending_operation &op, const boost::system::error_code &ec)
+    {
+        if (!op.events)
+            io_service_.post(boost::asio::detail::bind_handler(op.handler, ec, dir_monitor_event()));
+        else
+            io_service_.post(boost::asio::detail::bind_handler(op.batch_handler, ec, std::size_t(0)));
+    }
 
+    void do_async_monitor(pending_operation op)
+    {
+        if (!run_)
+            return fail(op, boost::asio::error::operation_aborted);
+        if (mode_ != async_mode)
+            return fail(op, boost::asio::error::operation_not_supported);
+
+        if (!reading_)
+        {
+            reading_ = true;
             begin_read();
         }
-        else if (ec != boost::asio::error::operation_aborted)
+        if (!pending_operations_.empty() || !try_complete(op))
         {
-            boost::system::system_error e(ec);
-            boost::throw_exception(e);
+            if (read_error_)
+                fail(op, read_error_);
+            else
+                pending_operations_.push_back(op);
         }
     }
 
-    std::string get_dirname(int wd)
+    void complete_pending()
     {
-        boost::unique_lock<boost::mutex> lock(watch_descriptors_mutex_);
-        watch_descriptors_t::left_map::iterator it = watch_descriptors_.left.find(wd);
-        return it != watch_descriptors_.left.end() ? it->second : "";
+        while (!pending_operations_.empty() && try_complete(pending_operations_.front()))
+            pending_operations_.pop_front();
     }
 
+    void abort_pending(const boost::system::error_code &ec)
+    {
+        for (std::deque<pending_operation>::iterator it = pending_operations_.begin(); it != pending_operations_.end(); ++it)
+            fail(*it, ec);
+        pending_operations_.clear();
+    }
+
+    void do_destroy()
+    {
+        boost::system::error_code ignored;
+        stream_descriptor_.close(ignored);
+        coalesce_timer_.cancel(ignored);
+        abort_pending(boost::asio::error::operation_aborted);
+    }
+
+    boost::posix_time::time_duration coalesce_window() const
+    {
+        return boost::posix_time::microseconds(coalesce_window_us_.load());
+    }
+
+    // Identifies the file of a held event by the event's own strings, so that
+    // looking one up doesn't build a path.
+    struct held_key
+    {
+        const std::string *dirname;
+        const std::string *filename;
+    };
+
+    struct held_key_hash
+    {
+        std::size_t operator()(const held_key &k) const
+        {
+            std::size_t seed = boost::hash_value(*k.dirname);
+            boost::hash_combine(seed, *k.filename);
+            return seed;
+        }
+    };
+
+    struct held_key_equal
+    {
+        bool operator()(const held_key &a, const held_key &b) const
+        {
+            return *a.filename == *b.filename && *a.dirname == *b.dirname;
+        }
+    };
+
+    static held_key key(const dir_monitor_event &ev)
+    {
+        held_key k = { &ev.dirname, &ev.filename };
+        return k;
+    }
+
+    // spsc_queue copies elements in and out, which for an event means copying
+    // both strings. Neither side touches an element again once it is handed
+    // over, so a copy moves instead.
+    struct queued_event
+    {
+        queued_event() { }
+
+        explicit queued_event(dir_monitor_event &ev)
+            : event(std::move(ev)) { }
+
+        queued_event(const queued_event &other)
+            : event(std::move(other.event)) { }
+
+        mutable dir_monitor_event event;
+    };
+
+    struct move_event_to
+    {
+        explicit move_event_to(dir_monitor_event &ev)
+            : ev(ev) { }
+
+        void operator()(queued_event &qe) const
+        {
+            ev = std::move(qe.event);
+        }
+
+        dir_monitor_event &ev;
+    };
+
+    // Watches.
+
+    static const boost::uint32_t watch_mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVE_SELF | IN_ONLYDIR;
+
+    bool add_watch(watch_map &watches, const std::string &dirname, bool recursive)
+    {
+        int wd = inotify_add_watch(fd_, dirname.c_str(), watch_mask);
+        if (wd == -1)
+            return false;
+
+        // Watching a directory again returns the same descriptor, possibly
+        // under another name if the directory was moved.
+        watch_map::by_wd_t::iterator old = watches.by_wd.find(wd);
+        if (old != watches.by_wd.end())
+        {
+            recursive = recursive || old->second.recursive;
+            watches.by_dirname.erase(old->second.dirname);
+        }
+        watch w = { dirname, recursive };
+        watches.by_wd[wd] = w;
+        watches.by_dirname[dirname] = wd;
+        return true;
+    }
+
+    // Stop watching dirname and every directory below it.
+    void drop_watches(const std::string &dirname)
+    {
+        boost::unique_lock<boost::mutex> lock(watches_mutex_);
+        std::string prefix = dirname + '/';
+        boost::shared_ptr<watch_map> watches(new watch_map(*watches_));
+        for (watch_map::by_wd_t::const_iterator w = watches_->by_wd.begin(); w != watches_->by_wd.end(); ++w)
+        {
+            if (w->second.dirname == dirname || w->second.dirname.compare(0, prefix.size(), prefix) == 0)
+            {
+                inotify_rm_watch(fd_, w->first);
+                remove_watch(*watches, w->first);
+            }
+        }
+        boost::atomic_store(&watches_, boost::shared_ptr<const watch_map>(watches));
+    }
+
+    static void remove_watch(watch_map &watches, int wd)
+    {
+        watch_map::by_wd_t::iterator it = watches.by_wd.find(wd);
+        if (it == watches.by_wd.end())
+            return;
+        watches.by_dirname.erase(it->second.dirname);
+        watches.by_wd.erase(it);
+    }
+
+    // Add the subdirectories of dirname to dirs. If entries isn't null, an
+    // added event is made for everything in dirname.
+    static void list_directory(const std::string &dirname, std::vector<std::string> &dirs, std::vector<dir_monitor_event> *entries)
+    {
+        boost::system::error_code ec;
+        for (boost::filesystem::directory_iterator it(dirname, ec), end; !ec && it != end; it.increment(ec))
+        {
+            boost::system::error_code status_ec;
+            if (entries)
+                entries->push_back(dir_monitor_event(dirname, it->path().filename().string(), dir_monitor_event::added));
+            if (boost::filesystem::is_directory(it->symlink_status(status_ec)))
+                dirs.push_back(it->path().string());
+        }
+    }
+
+    // Forget watches which the kernel dropped and watch directories created
+    // below recursive watches. Called in strand_.
+    void update_watches(boost::system_time now)
+    {
+        // Anything created in a new directory before it was watched has no
+        // events, so everything in it is reported as added. Each directory is
+        // listed after it is watched so nothing falls in between, at the cost
+        // of reporting some files twice.
+        std::vector<dir_monitor_event> entries;
+        {
+            boost::unique_lock<boost::mutex> lock(watches_mutex_);
+            boost::shared_ptr<watch_map> watches(new watch_map(*watches_));
+            for (std::vector<int>::iterator wd = ignored_wds_.begin(); wd != ignored_wds_.end(); ++wd)
+                remove_watch(*watches, *wd);
+            for (std::size_t i = 0; i < new_dirs_.size(); ++i)
+            {
+                if (add_watch(*watches, new_dirs_[i], true))
+                    list_directory(new_dirs_[i], new_dirs_, &entries);
+            }
+            boost::atomic_store(&watches_, boost::shared_ptr<const watch_map>(watches));
+        }
+
+        for (std::vector<dir_monitor_event>::iterator it = entries.begin(); it != entries.end(); ++it)
+            queue_event(*it, now);
+
+        ignored_wds_.clear();
+        new_dirs_.clear();
+    }
+
+    enum { event_queue_capacity = 4096 };
+
+    enum mode
+    {
+        unset_mode,
+        // Read by monitor() on the calling thread.
+        sync_mode,
+        // Read on the io_service for async_monitor().
+        async_mode
+    };
+
+    struct held_event
+    {
+        dir_monitor_event event;
+        boost::system_time due;
+    };
+
     int fd_;
-    boost::asio::io_service inotify_io_service_;
+    boost::asio::io_service &io_service_;
+    boost::asio::io_service::strand strand_;
     boost::asio::posix::stream_descriptor stream_descriptor_;
-    boost::scoped_ptr<boost::asio::io_service::work> inotify_work_;
-    boost::thread inotify_work_thread_;
-    boost::array<char, 4096> read_buffer_;
-    std::string pending_read_buffer_;
-    boost::mutex watch_descriptors_mutex_;
-    typedef boost::bimap<int, std::string> watch_descriptors_t;
-    watch_descriptors_t watch_descriptors_;
-    boost::mutex events_mutex_;
-    boost::condition_variable events_cond_;
-    bool run_;
-    std::deque<dir_monitor_event> events_;
+
+    // Only touched in strand_, or by the thread in read_event() for a
+    // monitor in sync_mode.
+    boost::asio::deadline_timer coalesce_timer_;
+    bool timer_armed_;
+    bool reading_;
+    std::list<held_event> held_;
+    // Keyed by the strings of the events in held_.
+    typedef boost::unordered_map<held_key, std::list<held_event>::iterator, held_key_hash, held_key_equal> held_index_t;
+    held_index_t held_index_;
+    std::deque<dir_monitor_event> backlog_;
+    std::deque<pending_operation> pending_operations_;
+    // Large enough to pick up a burst of events with a single read. It must
+    // hold at least one event with the longest possible name.
+    boost::array<char, 64 * 1024> read_buffer_;
+    std::size_t read_buffer_size_;
+
+    boost::lockfree::spsc_queue<queued_event> events_;
+    boost::atomic<std::size_t> backlog_size_;
+    boost::atomic<bool> run_;
+    // Set by the first wait, and never changed after.
+    boost::atomic<int> mode_;
+    boost::atomic<boost::int64_t> coalesce_window_us_;
+
+    // The error which ended reading. Only touched in strand_.
+    boost::system::error_code read_error_;
+    // Serializes monitor() in sync_mode.
+    boost::mutex sync_read_mutex_;
+    // Set by a batch which stopped at an overflow, so that the next wait
+    // reports it. Only touched by the one consumer.
+    bool overflow_pending_;
+    // Written to by destroy() to wake up monitor() in sync_mode.
+    int wake_fd_;
+
+    std::vector<int> ignored_wds_;
+    std::vector<std::string> new_dirs_;
+
+    // Watches are looked up for every event but rarely change, so they are
+    // kept in an immutable snapshot which readers load atomically and writers,
+    // serialized by watches_mutex_, copy and replace. Reading events never
+    // waits for a writer.
+    boost::mutex watches_mutex_;
+    boost::shared_ptr<const watch_map> watches_;
 };
 
 }
@@ -20,6 +20,7 @@
 #include <boost/system/error_code.hpp>
 #include <boost/system/system_error.hpp>
 #include <string>
+#include <vector>
 #include <stdexcept>
 #include <windows.h>
 
@@ -33,9 +34,10 @@ class basic_dir_monitor_service
 public:
     struct completion_key
     {
-        completion_key(HANDLE h, const std::string &d, boost::shared_ptr<DirMonitorImplementation> &i)
+        completion_key(HANDLE h, const std::string &d, bool r, boost::shared_ptr<DirMonitorImplementation> &i)
             : handle(h),
             dirname(d),
+            recursive(r),
             impl(i)
         {
             ZeroMemory(&overlapped, sizeof(overlapped));
@@ -43,6 +45,7 @@ public:
 
         HANDLE handle;
         std::string dirname;
+        bool recursive;
         boost::weak_ptr<DirMonitorImplementation> impl;
         char buffer[1024];
         OVERLAPPED overlapped;
@@ -52,6 +55,7 @@ public:
 
     explicit basic_dir_monitor_service(boost::asio::io_service &io_service)
         : boost::asio::io_service::service(io_service),
+        io_service_(io_service),
         iocp_(init_iocp()),
         run_(true),
         work_thread_(&boost::asio::basic_dir_monitor_service<DirMonitorImplementation>::work_thread, this),
@@ -97,7 +101,9 @@ public:
         impl.reset();
     }
 
-    void add_directory(implementation_type &impl, const std::string &dirname)
+    // With recursive set, changes anywhere below dirname are reported and the
+    // filename of each event is relative to dirname.
+    void add_directory(implementation_type &impl, const std::string &dirname, bool recursive = false)
     {
         if (!boost::filesystem::is_directory(dirname))
             throw std::invalid_argument("boost::asio::basic_dir_monitor_service::add_directory: " + dirname + " is not a valid directory entry");
@@ -106,29 +112,29 @@ public:
         if (handle == INVALID_HANDLE_VALUE)
         {
             DWORD last_error = GetLastError();
-            boost::system::system_error e(boost::system::error_code(last_error, boost::system::get_system_category()), "boost::asio::basic_dir_monitor_service::add_directory: CreateFile failed");
+            boost::system::system_error e(boost::system::error_code(last_error, boost::system::system_category()), "boost::asio::basic_dir_monitor_service::add_directory: CreateFile failed");
             boost::throw_exception(e);
         }
 
         // No smart pointer can be used as the pointer must travel as a completion key
         // through the I/O completion port module.
-        completion_key *ck = new completion_key(handle, dirname, impl);
+        completion_key *ck = new completion_key(handle, dirname, recursive, impl);
         iocp_ = CreateIoCompletionPort(ck->handle, iocp_, reinterpret_cast<unsigned long>(ck), 0);
         if (iocp_ == NULL)
         {
             delete ck;
             DWORD last_error = GetLastError();
-            boost::system::system_error e(boost::system::error_code(last_error, boost::system::get_system_category()), "boost::asio::basic_dir_monitor_service::add_directory: CreateIoCompletionPort failed");
+            boost::system::system_error e(boost::system::error_code(last_error, boost::system::system_category()), "boost::asio::basic_dir_monitor_service::add_directory: CreateIoCompletionPort failed");
             boost::throw_exception(e);
         }
 
         DWORD bytes_transferred; // ignored
-        BOOL res = ReadDirectoryChangesW(ck->handle, ck->buffer, sizeof(ck->buffer), FALSE, 0x1FF, &bytes_transferred, &ck->overlapped, NULL);
+        BOOL res = ReadDirectoryChangesW(ck->handle, ck->buffer, sizeof(ck->buffer), ck->recursive ? TRUE : FALSE, 0x1FF, &bytes_transferred, &ck->overlapped, NULL);
         if (!res)
         {
             delete ck;
             DWORD last_error = GetLastError();
-            boost::system::system_error e(boost::system::error_code(last_error, boost::system::get_system_category()), "boost::asio::basic_dir_monitor_service::add_directory: ReadDirectoryChangesW failed");
+            boost::system::system_error e(boost::system::error_code(last_error, boost::system::system_category()), "boost::asio::basic_dir_monitor_service::add_directory: ReadDirectoryChangesW failed");
             boost::throw_exception(e);
         }
 
@@ -143,6 +149,11 @@ public:
         impl->remove_directory(dirname);
     }
 
+    void set_coalesce_window(implementation_type &impl, boost::posix_time::time_duration window)
+    {
+        impl->set_coalesce_window(window);
+    }
+
     dir_monitor_event monitor(implementation_type &impl, boost::system::error_code &ec)
     {
         return impl->popfront_event(ec);
@@ -185,7 +196,57 @@ public:
     template <typename Handler>
     void async_monitor(implementation_type &impl, Handler handler)
     {
-        this->async_monitor_io_service_.post(monitor_operation<Handler>(impl, this->get_io_service(), handler));
+        this->async_monitor_io_service_.post(monitor_operation<Handler>(impl, this->io_service_, handler));
+    }
+
+    template <typename Handler>
+    class batch_monitor_operation
+    {
+    public:
+        batch_monitor_operation(implementation_type &impl, boost::asio::io_service &io_service, std::vector<dir_monitor_event> &events, Handler handler)
+            : impl_(impl),
+            io_service_(io_service),
+            work_(io_service),
+            events_(events),
+            handler_(handler)
+        {
+        }
+
+        void operator()() const
+        {
+            implementation_type impl = impl_.lock();
+            if (impl)
+            {
+                // Wait for the first event, then take everything else which is
+                // queued.
+                boost::system::error_code ec;
+                dir_monitor_event ev = impl->popfront_event(ec);
+                std::size_t count = 0;
+                if (!ec)
+                {
+                    events_.push_back(ev);
+                    count = 1 + impl->popfront_events(events_);
+                }
+                this->io_service_.post(boost::asio::detail::bind_handler(handler_, ec, count));
+            }
+            else
+            {
+                this->io_service_.post(boost::asio::detail::bind_handler(handler_, boost::asio::error::operation_aborted, std::size_t(0)));
+            }
+        }
+
+    private:
+        boost::weak_ptr<DirMonitorImplementation> impl_;
+        boost::asio::io_service &io_service_;
+        boost::asio::io_service::work work_;
+        std::vector<dir_monitor_event> &events_;
+        Handler handler_;
+    };
+
+    template <typename Handler>
+    void async_monitor_batch(implementation_type &impl, std::vector<dir_monitor_event> &events, Handler handler)
+    {
+        this->async_monitor_io_service_.post(batch_monitor_operation<Handler>(impl, this->io_service_, events, handler));
     }
 
 private:
@@ -199,7 +260,7 @@ private:
         if (iocp == NULL)
         {
             DWORD last_error = GetLastError();
-            boost::system::system_error e(boost::system::error_code(last_error, boost::system::get_system_category()), "boost::asio::basic_dir_monitor_service::init_iocp: CreateIoCompletionPort failed");
+            boost::system::system_error e(boost::system::error_code(last_error, boost::system::system_category()), "boost::asio::basic_dir_monitor_service::init_iocp: CreateIoCompletionPort failed");
             boost::throw_exception(e);
         }
         return iocp;
@@ -216,7 +277,7 @@ private:
             if (!res)
             {
                 DWORD last_error = GetLastError();
-                boost::system::system_error e(boost::system::error_code(last_error, boost::system::get_system_category()), "boost::asio::basic_dir_monitor_service::work_thread: GetQueuedCompletionStatus failed");
+                boost::system::system_error e(boost::system::error_code(last_error, boost::system::system_category()), "boost::asio::basic_dir_monitor_service::work_thread: GetQueuedCompletionStatus failed");
                 boost::throw_exception(e);
             }
 
@@ -258,12 +319,12 @@ private:
                         while (fni->NextEntryOffset);
 
                         ZeroMemory(&ck->overlapped, sizeof(ck->overlapped));
-                        BOOL res = ReadDirectoryChangesW(ck->handle, ck->buffer, sizeof(ck->buffer), FALSE, 0x1FF, &bytes_transferred, &ck->overlapped, NULL);
+                        BOOL res = ReadDirectoryChangesW(ck->handle, ck->buffer, sizeof(ck->buffer), ck->recursive ? TRUE : FALSE, 0x1FF, &bytes_transferred, &ck->overlapped, NULL);
                         if (!res)
                         {
                             delete ck;
                             DWORD last_error = GetLastError();
-                            boost::system::system_error e(boost::system::error_code(last_error, boost::system::get_system_category()), "boost::asio::basic_dir_monitor_service::work_thread: ReadDirectoryChangesW failed");
+                            boost::system::system_error e(boost::system::error_code(last_error, boost::system::system_category()), "boost::asio::basic_dir_monitor_service::work_thread: ReadDirectoryChangesW failed");
                             boost::throw_exception(e);
                         }
                     }
@@ -291,7 +352,7 @@ private:
         if (!res)
         {
             DWORD last_error = GetLastError();
-            boost::system::system_error e(boost::system::error_code(last_error, boost::system::get_system_category()), "boost::asio::basic_dir_monitor_service::stop_work_thread: PostQueuedCompletionStatus failed");
+            boost::system::system_error e(boost::system::error_code(last_error, boost::system::system_category()), "boost::asio::basic_dir_monitor_service::stop_work_thread: PostQueuedCompletionStatus failed");
             boost::throw_exception(e);
         }
     }
@@ -302,7 +363,7 @@ private:
         if (!size)
         {
             DWORD last_error = GetLastError();
-            boost::system::system_error e(boost::system::error_code(last_error, boost::system::get_system_category()), "boost::asio::basic_dir_monitor_service::to_utf8: WideCharToMultiByte failed");
+            boost::system::system_error e(boost::system::error_code(last_error, boost::system::system_category()), "boost::asio::basic_dir_monitor_service::to_utf8: WideCharToMultiByte failed");
             boost::throw_exception(e);
         }
 
@@ -321,13 +382,14 @@ private:
         if (!size)
         {
             DWORD last_error = GetLastError();
-            boost::system::system_error e(boost::system::error_code(last_error, boost::system::get_system_category()), "boost::asio::basic_dir_monitor_service::to_utf8: WideCharToMultiByte failed");
+            boost::system::system_error e(boost::system::error_code(last_error, boost::system::system_category()), "boost::asio::basic_dir_monitor_service::to_utf8: WideCharToMultiByte failed");
             boost::throw_exception(e);
         }
 
         return dynbuffer.get() ? std::string(dynbuffer.get(), size) : std::string(buffer, size);
     }
 
+    boost::asio::io_service &io_service_;
     HANDLE iocp_;
     boost::mutex work_thread_mutex_;
     bool run_;
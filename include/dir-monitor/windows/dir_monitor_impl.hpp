@@ -8,11 +8,12 @@
 #ifndef BOOST_ASIO_DIR_MONITOR_IMPL_HPP
 #define BOOST_ASIO_DIR_MONITOR_IMPL_HPP
 
+#include "../dir_monitor_event_queue.hpp"
 #include <boost/noncopyable.hpp>
 #include <boost/ptr_container/ptr_unordered_map.hpp>
 #include <boost/thread.hpp>
 #include <string>
-#include <deque>
+#include <vector>
 #include <windows.h>
 
 namespace boost {
@@ -40,7 +41,6 @@ public:
     };
 
     dir_monitor_impl()
-        : run_(true)
     {
     }
 
@@ -56,44 +56,32 @@ public:
 
     void destroy()
     {
-        boost::unique_lock<boost::mutex> lock(events_mutex_);
-        run_ = false;
-        events_cond_.notify_all();
+        events_.destroy();
+    }
+
+    void set_coalesce_window(boost::posix_time::time_duration window)
+    {
+        events_.set_coalesce_window(window);
     }
 
     dir_monitor_event popfront_event(boost::system::error_code &ec)
     {
-        boost::unique_lock<boost::mutex> lock(events_mutex_);
-        while (run_ && events_.empty())
-            events_cond_.wait(lock);
-        dir_monitor_event ev;
-        if (!events_.empty())
-        {
-            ec = boost::system::error_code();
-            ev = events_.front();
-            events_.pop_front();
-        }
-        else
-            ec = boost::asio::error::operation_aborted;
-        return ev;
+        return events_.popfront_event(ec);
+    }
+
+    std::size_t popfront_events(std::vector<dir_monitor_event> &evs)
+    {
+        return events_.popfront_events(evs);
     }
 
     void pushback_event(dir_monitor_event ev)
     {
-        boost::unique_lock<boost::mutex> lock(events_mutex_);
-        if (run_)
-        {
-            events_.push_back(ev);
-            events_cond_.notify_all();
-        }
+        events_.pushback_event(ev);
     }
 
 private:
     boost::ptr_unordered_map<std::string, windows_handle> dirs_;
-    boost::mutex events_mutex_;
-    boost::condition_variable events_cond_;
-    bool run_;
-    std::deque<dir_monitor_event> events_;
+    dir_monitor_event_queue events_;
 };
 
 }
@@ -0,0 +1,72 @@
+//===- Allocator.h - Bump pointer allocator ---------------------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares BumpPtrAllocator, an arena which hands out memory from
+// large slabs and frees it all at once.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_ALLOCATOR_H
+#define EVELOG_ALLOCATOR_H
+
+#include <cstddef>
+
+#include "evelog/StringRef.h"
+
+namespace evelog {
+
+/// BumpPtrAllocator - Allocates memory by bumping a pointer through slabs.
+/// Nothing is freed until the allocator is reset or destroyed, so it is only
+/// suitable for trivially destructible objects.
+///
+/// Each new slab is twice the size of the last, so the number of slabs, and
+/// therefore of calls to the system allocator, grows logarithmically.
+class BumpPtrAllocator {
+  BumpPtrAllocator(const BumpPtrAllocator &) = delete;
+  BumpPtrAllocator &operator =(const BumpPtrAllocator &) = delete;
+
+  struct Slab {
+    Slab *Next;
+  };
+
+  Slab *CurSlab;
+  char *CurPtr;
+  char *End;
+  std::size_t NextSlabSize;
+  std::size_t BytesAllocated;
+
+  void startNewSlab(std::size_t min_size);
+
+public:
+  explicit BumpPtrAllocator(std::size_t first_slab_size = 4096);
+  ~BumpPtrAllocator();
+
+  /// Free all slabs.
+  void reset();
+
+  /// Make sure the next \p size bytes of allocations fit in one slab.
+  void reserve(std::size_t size);
+
+  void *allocate(std::size_t size, std::size_t alignment);
+
+  template<typename T>
+  T *allocate(std::size_t num = 1) {
+    return static_cast<T*>(allocate(num * sizeof(T), alignof(T)));
+  }
+
+  /// Copy \p str into the arena.
+  StringRef save(StringRef str);
+
+  /// Total bytes handed out since the last reset.
+  std::size_t getBytesAllocated() const { return BytesAllocated; }
+};
+
+} // end namespace evelog.
+
+#endif
@@ -0,0 +1,131 @@
+//===- ArenaWorkspace.h - Arena allocated lbw reader ------------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares ArenaWorkspace, a Workspace whose devices, storages,
+// entries and strings are all placed in a single arena owned by the
+// workspace.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_ARENAWORKSPACE_H
+#define EVELOG_ARENAWORKSPACE_H
+
+#include <cstdint>
+#include <istream>
+
+#include "evelog/Allocator.h"
+#include "evelog/LBWReader.h"
+#include "evelog/MappedWorkspace.h"
+#include "evelog/StringRef.h"
+
+namespace evelog {
+
+class ArenaWorkspace;
+
+std::istream &operator >>(std::istream &is, ArenaWorkspace &ws);
+
+class ArenaDevice {
+  friend std::istream &operator >>(std::istream &is, ArenaWorkspace &ws);
+
+  const Channel *ChannelsBegin;
+  const Channel *ChannelsEnd;
+  /// The undecoded process module lists, if they were kept.
+  StringRef ProcessModuleData;
+public:
+  typedef const Channel *channel_iterator;
+
+  channel_iterator begin_channels() const { return ChannelsBegin; }
+  channel_iterator end_channels() const { return ChannelsEnd; }
+
+  /// Returns true if the device was read with
+  /// ParseOptions::KeepProcessModules.
+  bool hasProcessModules() const { return !ProcessModuleData.empty(); }
+
+  /// Decode the process module lists of the device's channels. This is done
+  /// anew on each call, so hold on to the result. Returns an empty table if
+  /// hasProcessModules() is false.
+  ProcessModuleTable getProcessModules() const;
+
+  StringRef Name;
+  StringRef Description;
+  double Created;
+  double Modified;
+  StringRef FileMappingName;
+  uint32_t FlushRate;
+  uint32_t Capacity;
+  uint32_t ChannelCount;
+};
+
+class ArenaStorage {
+  friend std::istream &operator >>(std::istream &is, ArenaWorkspace &ws);
+
+  const StorageEntryRef *EntriesBegin;
+  const StorageEntryRef *EntriesEnd;
+public:
+  typedef const StorageEntryRef *entry_iterator;
+
+  entry_iterator begin_entries() const { return EntriesBegin; }
+  entry_iterator end_entries() const { return EntriesEnd; }
+
+  StringRef Name;
+  StringRef Description;
+  double Created;
+  double Modified;
+  uint32_t InitialCapacity;
+  uint32_t IncrementalCapacity;
+};
+
+/// ArenaWorkspace - A Workspace read from a stream into an arena.
+///
+/// Parsing a file costs a handful of allocations instead of one or two per
+/// string, which keeps concurrent parses off the global allocator, and
+/// destroying the workspace frees everything at once.
+///
+/// The stream must be seekable, as its size bounds every count read from it.
+class ArenaWorkspace {
+  friend std::istream &operator >>(std::istream &is, ArenaWorkspace &ws);
+
+  ArenaWorkspace(const ArenaWorkspace &) = delete;
+  ArenaWorkspace &operator =(const ArenaWorkspace &) = delete;
+
+  BumpPtrAllocator Alloc;
+  const ArenaDevice *DevicesBegin;
+  const ArenaDevice *DevicesEnd;
+  const ArenaStorage *StoresBegin;
+  const ArenaStorage *StoresEnd;
+
+public:
+  ArenaWorkspace();
+
+  typedef const ArenaDevice *device_iterator;
+  typedef const ArenaStorage *storage_iterator;
+
+  device_iterator begin_devices() const { return DevicesBegin; }
+  device_iterator end_devices() const { return DevicesEnd; }
+
+  storage_iterator begin_stores() const { return StoresBegin; }
+  storage_iterator end_stores() const { return StoresEnd; }
+
+  const BumpPtrAllocator &getAllocator() const { return Alloc; }
+
+  StringRef Name;
+  StringRef Description;
+  double Created;
+  double Modified;
+  StringRef FilePath;
+};
+
+/// Read a workspace into \p ws, replacing its previous contents. The process
+/// module lists are copied into the arena if the stream's ParseOptions ask for
+/// them, and skipped otherwise.
+std::istream &operator >>(std::istream &is, ArenaWorkspace &ws);
+
+} // end namespace evelog.
+
+#endif
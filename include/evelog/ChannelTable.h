@@ -0,0 +1,116 @@
+//===- ChannelTable.h - Resolve channel IDs and hashes ----------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares ChannelTable, which maps the channel IDs of storage
+// entries and channel hashes to channels in constant time.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_CHANNELTABLE_H
+#define EVELOG_CHANNELTABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "evelog/LBWReader.h"
+#include "evelog/StringRef.h"
+
+namespace evelog {
+
+/// ChannelSet - A set of channel IDs which can be tested in constant time.
+class ChannelSet {
+  friend class ChannelTable;
+
+  std::vector<bool> Members;
+
+public:
+  bool contains(uint16_t channel_id) const {
+    return channel_id < Members.size() && Members[channel_id];
+  }
+
+  bool operator ()(const StorageEntry &se) const {
+    return contains(se.ChannelID);
+  }
+
+  /// Lets a ChannelSet be passed to EntryCursor::nextEntry as a filter.
+  bool operator ()(const EntryHeader &h) const {
+    return contains(h.ChannelID);
+  }
+};
+
+/// ChannelTable - Maps StorageEntry::ChannelID and (facility hash, object
+/// hash) pairs to channels in constant time.
+///
+/// A ChannelID is the index + 1 of a channel in the channel table. The table
+/// is the channels of every device of the workspace in order, which for the
+/// usual single device is that device's channels. ID 0 is no channel.
+///
+/// The table points into the workspace it was built from, which must outlive
+/// it.
+class ChannelTable {
+  struct HashPairHash {
+    std::size_t operator ()(const std::pair<uint64_t, uint64_t> &p) const {
+      return std::size_t(p.first ^ (p.second * 0x9E3779B97F4A7C15ULL));
+    }
+  };
+
+  typedef std::unordered_multimap<uint64_t, uint16_t> NameIndex;
+
+  /// Indexed by channel ID.
+  std::vector<const Channel *> ByID;
+  std::unordered_map<std::pair<uint64_t, uint64_t>, uint16_t, HashPairHash>
+    ByHash;
+  /// Channel IDs by the hash of their facility and object names.
+  NameIndex ByFacility;
+  NameIndex ByObject;
+
+  void add(const Channel &c);
+  static void select(const NameIndex &index, StringRef name,
+                     StringRef (Channel::*get)() const,
+                     const std::vector<const Channel *> &by_id,
+                     std::vector<bool> &out);
+
+public:
+  /// Build the table of the channels of \p ws. Works with Workspace,
+  /// MappedWorkspace and ArenaWorkspace.
+  template<typename WorkspaceT>
+  explicit ChannelTable(const WorkspaceT &ws) : ByID(1) {
+    for (auto d = ws.begin_devices(), de = ws.end_devices(); d != de; ++d)
+      for (auto c = d->begin_channels(), ce = d->end_channels(); c != ce; ++c)
+        add(*c);
+  }
+
+  /// Number of channels.
+  std::size_t size() const { return ByID.size() - 1; }
+
+  /// Get the channel with ID \p channel_id, or null if there isn't one.
+  const Channel *lookup(uint16_t channel_id) const {
+    return channel_id < ByID.size() ? ByID[channel_id] : 0;
+  }
+
+  const Channel *lookup(const StorageEntry &se) const {
+    return lookup(se.ChannelID);
+  }
+
+  /// Get the ID of the channel with the given hashes, or 0 if there isn't
+  /// one. If several channels share the hashes the first one is returned.
+  uint16_t findID(uint64_t facility_hash, uint64_t object_hash) const;
+
+  /// Select the channels whose facility is \p facility and whose object is
+  /// \p object. An empty name matches everything. Names are compared by hash
+  /// first, and only channels with matching hashes are compared in full.
+  ChannelSet select(StringRef facility, StringRef object = StringRef()) const;
+};
+
+} // end namespace evelog.
+
+#endif
@@ -0,0 +1,145 @@
+//===- ColumnarFile.h - Columnar export of a workspace ----------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares writeColumnarFile, which exports the entries of a
+// workspace to a compact columnar file, and ColumnarFile, which maps one for
+// scanning without parsing.
+//
+// The ID columns are dictionary encoded, as a file has few distinct channels,
+// processes and threads. Timestamps are delta encoded. The data of all the
+// entries is stored back to back in a single payload with an offset column.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_COLUMNARFILE_H
+#define EVELOG_COLUMNARFILE_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "evelog/MappedFile.h"
+#include "evelog/MappedWorkspace.h"
+#include "evelog/StringRef.h"
+
+namespace evelog {
+
+class Workspace;
+
+/// Write the entries of every storage of \p ws to \p os as a columnar file.
+/// Rows are in file order.
+void writeColumnarFile(const Workspace &ws, std::ostream &os);
+
+/// ColumnarFile - A memory mapped columnar file written by writeColumnarFile.
+///
+/// The layout of the file is checked when it is opened, so that decoding any
+/// range of rows afterwards can not read out of bounds. Dictionary codes and
+/// data offsets are checked as they are decoded, and throw parse_error if
+/// they are out of range.
+class ColumnarFile {
+public:
+  enum Encoding {
+    /// Values stored as is.
+    Plain,
+    /// A table of distinct values followed by a code per row indexing it.
+    Dictionary,
+    /// Absolute values every BlockSize rows followed by the signed difference
+    /// of each row from the previous one.
+    Delta
+  };
+
+  /// Column - Describes how one column is stored.
+  struct Column {
+    Encoding Enc;
+    /// Size in bytes of each dictionary or checkpoint value.
+    uint8_t ValueWidth;
+    /// Size in bytes of each dictionary code or delta.
+    uint8_t CodeWidth;
+    /// Rows per checkpoint of a Delta column.
+    uint32_t BlockSize;
+    /// Number of dictionary or checkpoint values.
+    uint64_t ValueCount;
+    /// The values, if any, followed by the codes.
+    StringRef Values;
+    StringRef Codes;
+  };
+
+  enum ColumnID {
+    ChannelIDColumn,
+    ThreadIDColumn,
+    ProcessIDColumn,
+    TimeStampColumn,
+    DataOffsetColumn,
+    PayloadColumn,
+    NumColumns
+  };
+
+  /// A range [Begin, End) of rows.
+  struct Range {
+    uint64_t Begin;
+    uint64_t End;
+
+    uint64_t size() const { return End - Begin; }
+    bool empty() const { return Begin == End; }
+  };
+
+private:
+  ColumnarFile(const ColumnarFile &) = delete;
+  ColumnarFile &operator =(const ColumnarFile &) = delete;
+
+  MappedFile File;
+  uint64_t Count;
+  uint32_t StorageCount;
+  /// One past the last row of each storage.
+  const char *StorageEnds;
+  Column Columns[NumColumns];
+
+  template<typename T>
+  void decodeDictionary(ColumnID c, uint64_t first, uint64_t count,
+                        T *out) const;
+
+public:
+  /// Map and check the columnar file at \p path. Throws std::system_error
+  /// if it can not be mapped and parse_error if it is malformed.
+  explicit ColumnarFile(StringRef path);
+
+  /// Number of rows.
+  uint64_t size() const { return Count; }
+
+  /// Get the name of column \p c as stored in the file.
+  static const char *getColumnName(ColumnID c);
+  const Column &getColumn(ColumnID c) const { return Columns[c]; }
+
+  uint32_t getStorageCount() const { return StorageCount; }
+  /// Get the rows of storage \p s.
+  Range getStorage(uint32_t s) const;
+
+  /// Decode the channel IDs of rows [first, first + count) into \p out.
+  void getChannelIDs(uint64_t first, uint64_t count, uint16_t *out) const;
+  /// Decode the thread IDs of rows [first, first + count) into \p out.
+  void getThreadIDs(uint64_t first, uint64_t count, uint32_t *out) const;
+  /// Decode the process IDs of rows [first, first + count) into \p out.
+  void getProcessIDs(uint64_t first, uint64_t count, uint32_t *out) const;
+  /// Decode the timestamps of rows [first, first + count) into \p out.
+  void getTimeStamps(uint64_t first, uint64_t count, uint64_t *out) const;
+
+  /// Get the data of all rows back to back.
+  StringRef getPayload() const { return Columns[PayloadColumn].Codes; }
+  /// Get the data of row \p n.
+  StringRef getData(uint64_t n) const;
+
+  /// Decode row \p n. This is a slow path for looking at a few rows: the
+  /// timestamp is rebuilt from its checkpoint, which can take up to
+  /// BlockSize steps per call. Use the bulk decoders for scanning.
+  StorageEntryRef getEntry(uint64_t n) const;
+};
+
+} // end namespace evelog.
+
+#endif
@@ -0,0 +1,85 @@
+//===- ColumnarStorage.h - Struct of arrays storage entries -----*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares ColumnarStorage, which holds the entries of a storage as
+// one contiguous array per field and a single shared payload buffer.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_COLUMNARSTORAGE_H
+#define EVELOG_COLUMNARSTORAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "evelog/LBWReader.h"
+#include "evelog/MappedWorkspace.h"
+#include "evelog/StringRef.h"
+
+namespace evelog {
+
+/// ColumnarStorage - The entries of a storage laid out as columns.
+///
+/// Entry i has channel ChannelIDs[i], thread ThreadIDs[i] and so on, and its
+/// data is Payload[DataOffsets[i], DataOffsets[i + 1]). Scanning one field
+/// only touches that field's column.
+class ColumnarStorage {
+  std::vector<uint16_t> ChannelIDs;
+  std::vector<uint32_t> ThreadIDs;
+  std::vector<uint64_t> TimeStamps;
+  std::vector<uint32_t> ProcessIDs;
+  std::vector<uint64_t> DataOffsets;
+  std::string Payload;
+
+  void appendEntry(uint16_t channel_id, uint32_t thread_id,
+                   uint64_t timestamp, StringRef data, uint32_t process_id);
+
+public:
+  ColumnarStorage();
+  explicit ColumnarStorage(const Storage &s);
+  explicit ColumnarStorage(const MappedStorage &s);
+
+  void clear();
+  void reserve(std::size_t entries, std::size_t payload_bytes);
+
+  void push_back(const StorageEntry &se);
+  void push_back(const StorageEntryRef &se);
+
+  std::size_t size() const { return ChannelIDs.size(); }
+  bool empty() const { return ChannelIDs.empty(); }
+
+  const std::vector<uint16_t> &getChannelIDs() const { return ChannelIDs; }
+  const std::vector<uint32_t> &getThreadIDs() const { return ThreadIDs; }
+  const std::vector<uint64_t> &getTimeStamps() const { return TimeStamps; }
+  const std::vector<uint32_t> &getProcessIDs() const { return ProcessIDs; }
+
+  /// Offsets of each entry's data in the payload, plus the end of the last.
+  const std::vector<uint64_t> &getDataOffsets() const { return DataOffsets; }
+  StringRef getPayload() const { return Payload; }
+
+  StringRef getData(std::size_t i) const {
+    return StringRef(Payload.data() + DataOffsets[i],
+                     std::size_t(DataOffsets[i + 1] - DataOffsets[i]));
+  }
+
+  StorageEntryRef getEntry(std::size_t i) const;
+
+  std::string Name;
+  std::string Description;
+  double Created;
+  double Modified;
+  uint32_t InitialCapacity;
+  uint32_t IncrementalCapacity;
+};
+
+} // end namespace evelog.
+
+#endif
@@ -14,13 +14,19 @@
 #ifndef EVELOG_ENDIAN_H
 #define EVELOG_ENDIAN_H
 
+#include <cstddef>
+#include <cstring>
 #include <istream>
 
 #include "evelog/SwapByteOrder.h"
 
 namespace evelog {
 
-inline bool isLittleEndianHost() {
+enum endianness {big, little};
+enum alignment {unaligned, aligned};
+
+namespace detail {
+inline bool probeLittleEndianHost() {
   union {
     int i;
     char c;
@@ -28,13 +34,53 @@ inline bool isLittleEndianHost() {
   i = 1;
   return c == 1;
 }
+} // end namespace detail
 
-inline bool isBigEndianHost() {
-  return !isLittleEndianHost();
+// Detect the host byte order at compile time where the compiler says what it
+// is. Otherwise it is checked at run time.
+#if defined(__BYTE_ORDER__) && defined(__ORDER_LITTLE_ENDIAN__) && \
+    __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+# define EVELOG_LITTLE_ENDIAN_HOST 1
+#elif defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && \
+      __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+# define EVELOG_BIG_ENDIAN_HOST 1
+#elif defined(_M_IX86) || defined(_M_X64) || defined(_M_ARM) || \
+      defined(__i386__) || defined(__x86_64__)
+# define EVELOG_LITTLE_ENDIAN_HOST 1
+#endif
+
+/// host_endian - The byte order of the host, if it is known at compile time.
+struct host_endian {
+#if defined(EVELOG_LITTLE_ENDIAN_HOST)
+  static const bool is_known = true;
+  static const endianness value = little;
+#elif defined(EVELOG_BIG_ENDIAN_HOST)
+  static const bool is_known = true;
+  static const endianness value = big;
+#else
+  static const bool is_known = false;
+#endif
+};
+
+// When the byte order is known these are constant expressions, and every
+// branch on them below is removed at compile time.
+#if defined(EVELOG_LITTLE_ENDIAN_HOST) || defined(EVELOG_BIG_ENDIAN_HOST)
+# define EVELOG_HOST_ENDIAN_CONSTEXPR constexpr
+#else
+# define EVELOG_HOST_ENDIAN_CONSTEXPR
+#endif
+
+inline EVELOG_HOST_ENDIAN_CONSTEXPR bool isLittleEndianHost() {
+#if defined(EVELOG_LITTLE_ENDIAN_HOST) || defined(EVELOG_BIG_ENDIAN_HOST)
+  return host_endian::value == little;
+#else
+  return detail::probeLittleEndianHost();
+#endif
 }
 
-enum endianness {big, little};
-enum alignment {unaligned, aligned};
+inline EVELOG_HOST_ENDIAN_CONSTEXPR bool isBigEndianHost() {
+  return !isLittleEndianHost();
+}
 
 namespace detail {
 
@@ -57,6 +103,50 @@ struct alignment_access_helper<value_type, unaligned>
 };
 #pragma pack(pop)
 
+/// Swap the byte order of each of the \p count values at \p values. Written as
+/// a plain loop so that the compiler can vectorize it.
+template<typename value_type>
+void swap_array(value_type *values, std::size_t count) {
+  for (std::size_t i = 0; i != count; ++i)
+    values[i] = SwapByteOrder(values[i]);
+}
+
+/// Returns true if values in \p endian order must be swapped on this host.
+template<endianness endian>
+inline EVELOG_HOST_ENDIAN_CONSTEXPR bool needs_swap() {
+  return (endian == little) != isLittleEndianHost();
+}
+
+template<typename value_type, endianness endian>
+void read_array(const void *memory, value_type *out, std::size_t count) {
+  std::memcpy(out, memory, count * sizeof(value_type));
+  if (needs_swap<endian>())
+    swap_array(out, count);
+}
+
+template<typename value_type, endianness endian>
+void write_array(void *memory, const value_type *values, std::size_t count) {
+  if (!needs_swap<endian>()) {
+    std::memcpy(memory, values, count * sizeof(value_type));
+    return;
+  }
+  char *p = static_cast<char *>(memory);
+  for (std::size_t i = 0; i != count; ++i) {
+    value_type v = SwapByteOrder(values[i]);
+    std::memcpy(p + i * sizeof(value_type), &v, sizeof(value_type));
+  }
+}
+
+template<typename value_type, endianness endian>
+void read_strided(const void *memory, std::size_t stride, value_type *out,
+                  std::size_t count) {
+  const char *p = static_cast<const char *>(memory);
+  for (std::size_t i = 0; i != count; ++i)
+    std::memcpy(out + i, p + i * stride, sizeof(value_type));
+  if (needs_swap<endian>())
+    swap_array(out, count);
+}
+
 } // end namespace detail
 
 namespace endian {
@@ -65,14 +155,14 @@ namespace endian {
     value_type t =
       reinterpret_cast<const detail::alignment_access_helper
         <value_type, align> *>(memory)->val;
-    if (isBigEndianHost())
+    if (detail::needs_swap<little>())
       return SwapByteOrder(t);
     return t;
   }
 
   template<typename value_type, alignment align>
   static void write_le(void *memory, value_type value) {
-    if (isBigEndianHost())
+    if (detail::needs_swap<little>())
       value = SwapByteOrder(value);
     reinterpret_cast<detail::alignment_access_helper<value_type, align> *>
       (memory)->val = value;
@@ -83,18 +173,56 @@ namespace endian {
     value_type t =
       reinterpret_cast<const detail::alignment_access_helper
         <value_type, align> *>(memory)->val;
-    if (isLittleEndianHost())
+    if (detail::needs_swap<big>())
       return SwapByteOrder(t);
     return t;
   }
 
   template<typename value_type, alignment align>
   static void write_be(void *memory, value_type value) {
-    if (isLittleEndianHost())
+    if (detail::needs_swap<big>())
       value = SwapByteOrder(value);
     reinterpret_cast<detail::alignment_access_helper<value_type, align> *>
       (memory)->val = value;
   }
+
+  /// Decode \p count consecutive little endian values at \p memory, which
+  /// need not be aligned, into \p out. On little endian hosts this is a
+  /// memcpy.
+  template<typename value_type>
+  void read_le_array(const void *memory, value_type *out, std::size_t count) {
+    detail::read_array<value_type, little>(memory, out, count);
+  }
+
+  /// Decode \p count consecutive big endian values at \p memory into \p out.
+  template<typename value_type>
+  void read_be_array(const void *memory, value_type *out, std::size_t count) {
+    detail::read_array<value_type, big>(memory, out, count);
+  }
+
+  /// Encode \p count values as consecutive little endian values at
+  /// \p memory.
+  template<typename value_type>
+  void write_le_array(void *memory, const value_type *values,
+                      std::size_t count) {
+    detail::write_array<value_type, little>(memory, values, count);
+  }
+
+  /// Encode \p count values as consecutive big endian values at \p memory.
+  template<typename value_type>
+  void write_be_array(void *memory, const value_type *values,
+                      std::size_t count) {
+    detail::write_array<value_type, big>(memory, values, count);
+  }
+
+  /// Decode one little endian field from each of \p count fixed size records
+  /// which are \p stride bytes apart. \p memory points at the field in the
+  /// first record.
+  template<typename value_type>
+  void read_le_strided(const void *memory, std::size_t stride,
+                       value_type *out, std::size_t count) {
+    detail::read_strided<value_type, little>(memory, stride, out, count);
+  }
 }
 
 namespace detail {
@@ -0,0 +1,60 @@
+//===- EntryScanner.h - Find entries and lines in one pass ------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares scanEntries, which walks a run of storage entries and
+// measures the text of each one in the same sweep.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_ENTRYSCANNER_H
+#define EVELOG_ENTRYSCANNER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "evelog/StringRef.h"
+
+namespace evelog {
+
+/// TextShape - The extent of the text in a storage entry's data.
+///
+/// The logserver null terminates messages and often ends them with a newline,
+/// so the text is the data up to the first NUL without trailing whitespace.
+struct TextShape {
+  /// Size of the text in bytes.
+  uint32_t Size;
+  /// Number of lines in the text. 0 if the text is empty.
+  uint32_t LineCount;
+};
+
+/// EntryShape - The framing of a storage entry and the shape of its text.
+struct EntryShape {
+  /// Offset of the entry from the start of the scanned buffer.
+  uint64_t Offset;
+  /// Size of the entry's data as recorded in its header.
+  uint32_t DataSize;
+  TextShape Text;
+};
+
+/// Measure the text in \p data. Uses SSE2 or AVX2 when the host has them.
+TextShape scanText(StringRef data);
+
+/// Walk the consecutive storage entries which fill \p entries, such as
+/// MappedStorage::getEntries(), and append the shape of each one to
+/// \p shapes. Throws parse_error if an entry runs past the end of the buffer.
+/// Returns the number of entries scanned.
+std::size_t scanEntries(StringRef entries, std::vector<EntryShape> &shapes);
+
+/// Returns the name of the instruction set scanText uses on this host.
+const char *getScannerISA();
+
+} // end namespace evelog.
+
+#endif
@@ -0,0 +1,150 @@
+//===- LBWArchive.h - Block compressed lbw archives -------------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares writeArchive, which converts a lbw file to a block
+// compressed archive, and LBWArchive, which reads one.
+//
+// The entries of each storage are grouped into blocks of about
+// ArchiveOptions::BlockSize bytes which are compressed independently with
+// zlib. An index at the end of the archive records the time range and
+// channels of each block, so a time window can be read by decompressing only
+// the blocks which overlap it. Everything in the lbw file other than the
+// entries is kept too, so the original file can be restored byte for byte.
+//
+// These are built into the evelog-archive library, which links zlib and is
+// left out of the build if zlib isn't found.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_LBWARCHIVE_H
+#define EVELOG_LBWARCHIVE_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "evelog/LBWReader.h"
+#include "evelog/MappedFile.h"
+#include "evelog/StringRef.h"
+
+namespace evelog {
+
+struct ArchiveOptions {
+  /// Uncompressed bytes of entries per block. A block ends with the first
+  /// entry which reaches this size, and never spans storages.
+  uint32_t BlockSize;
+  /// zlib compression level, 0 to 9.
+  int Level;
+  /// Threads used to compress blocks. 0 means one per hardware thread.
+  unsigned NumThreads;
+
+  ArchiveOptions() : BlockSize(256 * 1024), Level(6), NumThreads(0) {}
+};
+
+/// Convert the lbw file in \p buffer to an archive written to \p os. Throws
+/// parse_error if the lbw file is malformed.
+void writeArchive(StringRef buffer, std::ostream &os,
+                  const ArchiveOptions &opts = ArchiveOptions());
+
+/// ArchiveBlock - The index record of a compressed block of entries.
+struct ArchiveBlock {
+  /// Offset of the compressed data in the archive.
+  uint64_t Offset;
+  uint32_t CompressedSize;
+  uint32_t RawSize;
+  /// The storage the entries belong to.
+  uint32_t Storage;
+  uint32_t EntryCount;
+  /// The smallest and largest timestamp of the entries.
+  uint64_t MinTimeStamp;
+  uint64_t MaxTimeStamp;
+  /// Bit (ChannelID % 256) is set for the channel of each entry.
+  uint8_t Channels[32];
+  /// zlib crc32 of the uncompressed entries.
+  uint32_t CRC;
+
+  /// Returns true if some entry may have t0 <= TimeStamp <= t1.
+  bool overlaps(uint64_t t0, uint64_t t1) const {
+    return MinTimeStamp <= t1 && t0 <= MaxTimeStamp;
+  }
+
+  /// Returns false if no entry has \p channel_id. May return true for a
+  /// channel which isn't there if there are more than 256 channels.
+  bool mayContainChannel(uint16_t channel_id) const {
+    return (Channels[(channel_id & 0xFF) >> 3] >> (channel_id & 7)) & 1;
+  }
+};
+
+/// LBWArchive - A memory mapped archive written by writeArchive.
+///
+/// The header and index are checked when the archive is opened. Blocks are
+/// checked against their CRC as they are decompressed, and throw parse_error
+/// if they are corrupt.
+class LBWArchive {
+  LBWArchive(const LBWArchive &) = delete;
+  LBWArchive &operator =(const LBWArchive &) = delete;
+
+  struct StorageRecord {
+    /// Where the storage's entries go in the skeleton.
+    uint64_t InsertAt;
+    uint64_t FirstBlock;
+    uint64_t BlockCount;
+  };
+
+  MappedFile File;
+  std::vector<ArchiveBlock> Blocks;
+  std::vector<StorageRecord> Stores;
+  /// Offset, compressed size and uncompressed size of the skeleton, the
+  /// bytes of the lbw file which aren't entries.
+  uint64_t SkeletonOffset;
+  uint64_t SkeletonCompressedSize;
+  uint64_t SkeletonRawSize;
+
+  void decompress(uint64_t offset, uint64_t compressed_size, char *out,
+                  uint64_t raw_size) const;
+
+public:
+  /// Map and check the archive at \p path. Throws std::system_error if it
+  /// can not be mapped and parse_error if it is malformed.
+  explicit LBWArchive(StringRef path);
+
+  uint64_t getBlockCount() const { return Blocks.size(); }
+  const ArchiveBlock &getBlock(uint64_t b) const { return Blocks[b]; }
+
+  /// Find the blocks which may have entries with t0 <= TimeStamp <= t1,
+  /// where the times are FILETIMEs.
+  std::vector<uint64_t> findBlocks(uint64_t t0, uint64_t t1) const;
+
+  /// Decompress block \p b into \p raw, which then holds its entries as
+  /// they are laid out in a lbw file.
+  void readBlock(uint64_t b, std::string &raw) const;
+
+  /// Decompress block \p b and append its entries to \p entries.
+  void readEntries(uint64_t b, std::vector<StorageEntry> &entries) const;
+
+  /// Append the entries with t0 <= TimeStamp <= t1 to \p entries in file
+  /// order. Only the blocks which overlap the window are decompressed, on
+  /// up to \p num_threads threads. 0 means one per hardware thread.
+  void readEntries(uint64_t t0, uint64_t t1,
+                   std::vector<StorageEntry> &entries,
+                   unsigned num_threads = 0) const;
+
+  /// Restore the original lbw file, decompressing blocks on up to
+  /// \p num_threads threads.
+  std::string extract(unsigned num_threads = 0) const;
+
+  /// Decode the archive into \p ws, exactly as the original lbw file would
+  /// be decoded.
+  void readWorkspace(Workspace &ws, unsigned num_threads = 0) const;
+};
+
+} // end namespace evelog.
+
+#endif
@@ -0,0 +1,177 @@
+//===- LBWIndex.h - Sidecar offset index for lbw files ----------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares LBWIndex, a compact on disk index of every storage entry
+// in a lbw file, and IndexedWorkspace, which uses it for random access.
+//
+// The index is written next to the lbw file with an "idx" suffix (foo.lbw ->
+// foo.lbwidx). It is memory mapped when opened and only its header is checked,
+// so queries do not need to read the whole index, let alone the lbw file. The
+// sorted tables are checked as queries read them.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_LBWINDEX_H
+#define EVELOG_LBWINDEX_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "evelog/MappedFile.h"
+#include "evelog/MappedWorkspace.h"
+#include "evelog/StringRef.h"
+
+namespace evelog {
+
+/// IndexEntry - The fixed size header of a storage entry and where it is.
+struct IndexEntry {
+  uint64_t Offset;
+  uint64_t TimeStamp;
+  uint32_t ThreadID;
+  uint32_t ProcessID;
+  uint32_t Storage;
+  uint16_t ChannelID;
+};
+
+/// FileStamp - Identifies a version of a file by its size and modification
+/// time.
+struct FileStamp {
+  uint64_t Size;
+  /// Nanoseconds since the epoch, where the platform records them.
+  int64_t ModificationTime;
+
+  /// Stat \p path. Throws std::system_error if it can not be.
+  static FileStamp get(StringRef path);
+
+  bool operator ==(const FileStamp &other) const {
+    return Size == other.Size && ModificationTime == other.ModificationTime;
+  }
+  bool operator !=(const FileStamp &other) const { return !(*this == other); }
+};
+
+class LBWIndex {
+  LBWIndex(const LBWIndex &) = delete;
+  LBWIndex &operator =(const LBWIndex &) = delete;
+
+  std::unique_ptr<MappedFile> File;
+  std::string Owned;
+  StringRef Buffer;
+  uint64_t Count;
+
+  bool setBuffer(StringRef buffer);
+  uint32_t getPosition(uint64_t table, uint64_t pos) const;
+
+public:
+  /// A range [Begin, End) of positions in one of the sorted orders.
+  struct Range {
+    uint64_t Begin;
+    uint64_t End;
+
+    uint64_t size() const { return End - Begin; }
+    bool empty() const { return Begin == End; }
+  };
+
+  LBWIndex();
+  ~LBWIndex();
+
+  /// Get the path of the index for the lbw file at \p lbw_path.
+  static std::string getIndexPath(StringRef lbw_path);
+
+  /// Build an index in memory of the lbw file in \p buffer, which was read
+  /// from a file with stamp \p stamp.
+  void build(StringRef buffer, const FileStamp &stamp);
+
+  /// Map the index at \p index_path. Returns false if it does not exist, has
+  /// a malformed header, or was not built from a file with stamp \p stamp.
+  /// Lookups throw parse_error if they find a corrupt table entry.
+  bool open(StringRef index_path, const FileStamp &stamp);
+
+  /// Write the index to \p index_path. Throws std::system_error on failure.
+  void write(StringRef index_path) const;
+
+  FileStamp getSourceStamp() const;
+
+  /// Number of entries in the index.
+  uint64_t size() const { return Count; }
+
+  /// Get entry \p n in file order.
+  IndexEntry getEntry(uint64_t n) const;
+
+  /// Decode the timestamps of entries [first, first + count) in file order
+  /// into \p out.
+  void getTimeStamps(uint64_t first, uint64_t count, uint64_t *out) const;
+
+  /// Decode the thread IDs of entries [first, first + count) in file order
+  /// into \p out.
+  void getThreadIDs(uint64_t first, uint64_t count, uint32_t *out) const;
+
+  /// Decode the channel IDs of entries [first, first + count) in file order
+  /// into \p out.
+  void getChannelIDs(uint64_t first, uint64_t count, uint16_t *out) const;
+
+  /// Decode the file order numbers of the entries at positions
+  /// [first, first + count) in time order into \p out.
+  void getTimeOrder(uint64_t first, uint64_t count, uint32_t *out) const;
+
+  /// Get the entry at position \p pos in time order.
+  IndexEntry getEntryByTime(uint64_t pos) const;
+
+  /// Get the entry at position \p pos in (channel, time) order.
+  IndexEntry getEntryByChannel(uint64_t pos) const;
+
+  /// Find the positions in time order of the entries with t0 <= TimeStamp
+  /// <= t1.
+  Range findTimeRange(uint64_t t0, uint64_t t1) const;
+
+  /// Find the positions in channel order of the entries of \p channel.
+  Range findChannel(uint16_t channel) const;
+
+  /// Find the positions in channel order of the entries of \p channel with
+  /// t0 <= TimeStamp <= t1.
+  Range findChannel(uint16_t channel, uint64_t t0, uint64_t t1) const;
+};
+
+/// IndexedWorkspace - Random access to the storage entries of a lbw file.
+///
+/// The lbw file is mapped but not parsed. Its index is opened if it is up to
+/// date, and otherwise is rebuilt and, if \p write_index is set, saved for
+/// next time.
+class IndexedWorkspace {
+  MappedFile File;
+  LBWIndex Index;
+
+  StorageEntryRef decodeAt(uint64_t offset) const;
+
+public:
+  explicit IndexedWorkspace(StringRef path, bool write_index = true);
+
+  const LBWIndex &getIndex() const { return Index; }
+
+  uint64_t size() const { return Index.size(); }
+
+  /// Get entry \p n in file order.
+  StorageEntryRef getEntry(uint64_t n) const {
+    return decodeAt(Index.getEntry(n).Offset);
+  }
+
+  /// Get the entry at position \p pos in time order.
+  StorageEntryRef getEntryByTime(uint64_t pos) const {
+    return decodeAt(Index.getEntryByTime(pos).Offset);
+  }
+
+  /// Get the entry at position \p pos in (channel, time) order.
+  StorageEntryRef getEntryByChannel(uint64_t pos) const {
+    return decodeAt(Index.getEntryByChannel(pos).Offset);
+  }
+};
+
+} // end namespace evelog.
+
+#endif
@@ -0,0 +1,66 @@
+//===- LBWLayout.h - Structural lbw scanner ---------------------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares a fast structural pre-scan of a lbw buffer, and a decoder
+// which uses the result to decode storage entries on multiple threads.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_LBWLAYOUT_H
+#define EVELOG_LBWLAYOUT_H
+
+#include <cstdint>
+#include <vector>
+
+#include "evelog/LBWReader.h"
+#include "evelog/StringRef.h"
+
+namespace evelog {
+
+/// ByteRange - The half open range [Begin, End) of offsets into a buffer.
+struct ByteRange {
+  uint64_t Begin;
+  uint64_t End;
+};
+
+struct StorageLayout {
+  /// The storage header, up to the first entry.
+  ByteRange Header;
+  /// All of the storage's entries.
+  ByteRange Entries;
+  /// The offset of each entry. Entry i ends where entry i + 1 begins, and the
+  /// last entry ends at Entries.End.
+  std::vector<uint64_t> EntryOffsets;
+};
+
+/// LBWLayout - Where each part of a lbw file lives.
+struct LBWLayout {
+  /// The workspace header, up to the first device.
+  ByteRange Header;
+  std::vector<ByteRange> Devices;
+  std::vector<StorageLayout> Stores;
+};
+
+/// Walk the structure of the lbw file in \p buffer without decoding or
+/// copying any entry data. Throws parse_error if the buffer is malformed.
+LBWLayout scanLayout(StringRef buffer);
+
+/// Decode the lbw file in \p buffer into \p ws using \p layout, which must
+/// have been scanned from the same buffer. Entries are decoded in chunks spread
+/// over \p num_threads threads. If \p num_threads is 0 one thread per hardware
+/// thread is used. Anything \p ws held before is replaced.
+void decodeParallel(StringRef buffer, const LBWLayout &layout, Workspace &ws,
+                    unsigned num_threads = 0);
+
+/// Scan and then decode the lbw file in \p buffer into \p ws.
+void decodeParallel(StringRef buffer, Workspace &ws, unsigned num_threads = 0);
+
+} // end namespace evelog.
+
+#endif
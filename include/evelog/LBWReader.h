@@ -18,17 +18,41 @@
 #include <istream>
 #include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "evelog/Endian.h"
 #include "evelog/StringRef.h"
+#include "evelog/Time.h"
 
 namespace evelog {
 
+struct LBWLayout;
+class ProcessModuleTable;
+class Workspace;
+
 struct parse_error : public std::runtime_error {
   parse_error(const char *msg) : std::runtime_error(msg) {}
 };
 
+/// ParseOptions - Controls what the operator >> overloads below, EntryCursor
+/// and ArenaWorkspace keep of the optional parts of a lbw file. They are
+/// attached to a stream with setParseOptions(), and default to skipping
+/// everything optional. Readers which don't take a stream, MappedWorkspace,
+/// decodeParallel and LiveStorageReader, always skip the optional parts.
+struct ParseOptions {
+  /// Keep each device's process module lists for Device::getProcessModules.
+  /// Otherwise they are skipped without being decoded.
+  bool KeepProcessModules;
+
+  ParseOptions() : KeepProcessModules(false) {}
+};
+
+/// Set the options used when reading from \p s.
+void setParseOptions(std::ios_base &s, const ParseOptions &opts);
+/// Get the options used when reading from \p s.
+ParseOptions getParseOptions(std::ios_base &s);
+
 class Channel {
   little64_t facility_hash;
   little64_t object_hash;
@@ -37,7 +61,12 @@ class Channel {
   char unk[0x0e];
 
 public:
+  uint64_t getFacilityHash() const { return uint64_t(int64_t(facility_hash)); }
+  uint64_t getObjectHash() const { return uint64_t(int64_t(object_hash)); }
+
+  /// Get the facility name. It is stored null padded.
   StringRef getFacility() const;
+  /// Get the object name. It is stored null padded.
   StringRef getObject() const;
 };
 
@@ -46,14 +75,28 @@ static_assert(sizeof(Channel) == 0x60,
 
 class Device {
   friend std::istream &operator >>(std::istream &is, Device &d);
+  friend class LiveStorageReader;
+  friend void decodeParallel(StringRef buffer, const LBWLayout &layout,
+                             Workspace &ws, unsigned num_threads);
 
   std::vector<Channel> Channels;
+  /// The undecoded process module lists, if they were kept.
+  std::string ProcessModuleData;
 public:
   typedef std::vector<Channel>::const_iterator channel_iterator;
 
   channel_iterator begin_channels() const { return Channels.begin(); }
   channel_iterator end_channels() const { return Channels.end(); }
 
+  /// Returns true if the device was read with
+  /// ParseOptions::KeepProcessModules.
+  bool hasProcessModules() const { return !ProcessModuleData.empty(); }
+
+  /// Decode the process module lists of the device's channels. This is done
+  /// anew on each call, so hold on to the result. Returns an empty table if
+  /// hasProcessModules() is false.
+  ProcessModuleTable getProcessModules() const;
+
   std::string Name;
   std::string Description;
   double Created;
@@ -69,23 +112,57 @@ std::istream &operator >>(std::istream &is, Device &d);
 struct StorageEntry {
   uint16_t ChannelID;
   uint32_t ThreadID;
+  /// A Windows FILETIME.
   uint64_t TimeStamp;
   std::string Data;
   uint32_t ProcessID;
+
+  /// Get TimeStamp in nanoseconds since the Unix epoch.
+  int64_t getUnixTime() const { return fileTimeToUnixNanos(TimeStamp); }
 };
 
 std::istream &operator >>(std::istream &is, StorageEntry &se);
 
+/// EntryHeader - The fixed size fields which come before a storage entry's
+/// data. The ProcessID is stored after the data, so it is not one of them.
+struct EntryHeader {
+  uint16_t ChannelID;
+  uint32_t ThreadID;
+  /// A Windows FILETIME.
+  uint64_t TimeStamp;
+  /// Size of the entry's data.
+  uint32_t DataSize;
+};
+
 class Storage {
   friend std::istream &operator >>(std::istream &is, Storage &s);
+  friend class EntryCursor;
+  friend void decodeParallel(StringRef buffer, const LBWLayout &layout,
+                             Workspace &ws, unsigned num_threads);
 
   std::vector<StorageEntry> Entries;
+  /// The index of the first entry of each run of entries in time order.
+  std::vector<std::size_t> RunStarts;
+
+  /// Find the runs of entries in time order. Must be called whenever Entries
+  /// is filled.
+  void findRuns();
+
 public:
   typedef std::vector<StorageEntry>::const_iterator entry_iterator;
+  typedef std::pair<entry_iterator, entry_iterator> entry_range;
 
   entry_iterator begin_entries() const { return Entries.begin(); }
   entry_iterator end_entries() const { return Entries.end(); }
 
+  /// Find the entries with t0 <= TimeStamp <= t1, where the times are
+  /// FILETIMEs. See unixNanosToFileTime.
+  ///
+  /// Entries are appended in time order, so each run of entries in time order
+  /// is binary searched. A storage written in order is a single run. The
+  /// ranges are returned in file order, and empty ones are left out.
+  std::vector<entry_range> entries_between(uint64_t t0, uint64_t t1) const;
+
   std::string Name;
   std::string Description;
   double Created;
@@ -98,6 +175,10 @@ std::istream &operator >>(std::istream &is, Storage &s);
 
 class Workspace {
   friend std::istream &operator >>(std::istream &is, Workspace &ws);
+  friend class EntryCursor;
+  friend class LiveStorageReader;
+  friend void decodeParallel(StringRef buffer, const LBWLayout &layout,
+                             Workspace &ws, unsigned num_threads);
 
   std::vector<Device> Devices;
   std::vector<Storage> Stores;
@@ -120,6 +201,68 @@ public:
 
 std::istream &operator >>(std::istream &is, Workspace &ws);
 
+/// EntryCursor - Reads a workspace from a stream one storage entry at a time,
+/// so that only a single entry is ever held in memory.
+///
+/// The workspace header and devices are read when the cursor is constructed.
+/// Each call to nextStorage() reads the header of the next storage, leaving
+/// its entries to be read by nextEntry().
+///
+/// The stream must be seekable, as unknown fields and unread entries are
+/// seeked over.
+class EntryCursor {
+  std::istream &IS;
+  Workspace WS;
+  uint32_t StoragesLeft;
+  uint32_t EntriesLeft;
+
+public:
+  explicit EntryCursor(std::istream &is);
+
+  /// Get the workspace header and devices. The workspace has no storages.
+  const Workspace &getWorkspace() const { return WS; }
+
+  /// Read the header of the next storage into \p s, skipping any entries of
+  /// the current storage which have not been read. Returns false if there are
+  /// no storages left.
+  bool nextStorage(Storage &s);
+
+  /// Read the next entry of the current storage into \p se, reusing its
+  /// data buffer. Returns false at the end of the storage.
+  bool nextEntry(StorageEntry &se);
+
+  /// Read the next entry of the current storage for which \p pred returns
+  /// true into \p se. Returns false at the end of the storage.
+  ///
+  /// \p pred is called with the EntryHeader of each entry as soon as it is
+  /// read, so the data of rejected entries is never copied out of the stream.
+  template<typename Predicate>
+  bool nextEntry(StorageEntry &se, Predicate pred) {
+    EntryHeader h;
+    while (nextHeader(h)) {
+      if (pred(static_cast<const EntryHeader &>(h))) {
+        readData(h, se);
+        return true;
+      }
+      skipData(h);
+    }
+    return false;
+  }
+
+  /// Rejected entries with at least this much data are seeked over by the
+  /// filtering nextEntry, and smaller ones are ignored. Seeking discards the
+  /// stream's buffer, so it only pays off for data larger than the buffer.
+  static const uint32_t SeekThreshold = 64 * 1024;
+
+private:
+  /// Read the header of the next entry, leaving the stream at its data.
+  bool nextHeader(EntryHeader &h);
+  /// Read the data and trailer of the entry whose header was just read.
+  void readData(const EntryHeader &h, StorageEntry &se);
+  /// Skip the data and trailer of the entry whose header was just read.
+  void skipData(const EntryHeader &h);
+};
+
 } // end namespace evelog.
 
 #endif
@@ -0,0 +1,103 @@
+//===- LiveStorageReader.h - Follow a growing lbw file ----------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares LiveStorageReader, which follows a lbw file while the
+// logserver is still appending to it.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_LIVESTORAGEREADER_H
+#define EVELOG_LIVESTORAGEREADER_H
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "evelog/LBWReader.h"
+
+namespace evelog {
+
+/// LiveStorageReader - Incrementally decodes a lbw file which is growing.
+///
+/// The reader remembers the file offset just past the last structure it fully
+/// decoded. Each call to update() reads only the bytes appended since then, a
+/// chunk at a time. When the file ends in the middle of an entry, the partial
+/// bytes are held back until a later update() completes it.
+///
+/// Process module lists are always skipped, whatever the ParseOptions.
+///
+/// The last storage in the file is the one being appended to, so its entries
+/// are read until the end of the file, even past its recorded entry count.
+class LiveStorageReader {
+  LiveStorageReader(const LiveStorageReader &) = delete;
+  LiveStorageReader &operator =(const LiveStorageReader &) = delete;
+
+  enum State {
+    ReadingHeader,
+    ReadingStorageHeader,
+    ReadingEntries
+  };
+
+public:
+  /// The device and inode of a file, or on Windows its device and creation
+  /// time.
+  typedef std::pair<uint64_t, uint64_t> FileIdentity;
+
+private:
+  std::string Path;
+  std::ifstream File;
+  /// Identity of the file at Path when File was opened.
+  FileIdentity Identity;
+  /// Bytes read from the file but not yet decoded. The first one is at
+  /// Offset in the file.
+  std::string Pending;
+  uint64_t Offset;
+  State CurState;
+  Workspace WS;
+  Storage CurStorage;
+  uint32_t StoragesLeft;
+  uint32_t EntriesLeft;
+
+  void restart();
+  std::size_t decodePending(std::vector<StorageEntry> &entries);
+
+public:
+  /// The file need not exist yet. It is opened by the first update() which
+  /// finds it.
+  explicit LiveStorageReader(std::string path);
+
+  /// Decode everything appended to the file since the last call and add the
+  /// complete entries to \p entries. Returns the number of entries added.
+  ///
+  /// If another file has been moved to the path, or the file has shrunk, it
+  /// is read again from the start. Throws parse_error if an entry is
+  /// impossibly large.
+  std::size_t update(std::vector<StorageEntry> &entries);
+
+  const std::string &getPath() const { return Path; }
+
+  /// Get the file offset just past the last fully decoded structure.
+  uint64_t getOffset() const { return Offset; }
+
+  /// Returns true once the workspace header and devices have been read.
+  bool hasWorkspace() const { return CurState != ReadingHeader; }
+
+  /// Get the workspace header and devices. The workspace has no storages.
+  const Workspace &getWorkspace() const { return WS; }
+
+  /// Get the header of the storage the last decoded entries belong to. It has
+  /// no entries.
+  const Storage &getStorage() const { return CurStorage; }
+};
+
+} // end namespace evelog.
+
+#endif
@@ -0,0 +1,49 @@
+//===- MappedFile.h - Read only memory mapped file --------------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares MappedFile, a read only view of a whole file.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_MAPPEDFILE_H
+#define EVELOG_MAPPEDFILE_H
+
+#include <cstddef>
+
+#include "evelog/StringRef.h"
+
+namespace evelog {
+
+/// MappedFile - Maps an entire file read only into memory. Throws
+/// std::system_error if the file can not be opened or mapped.
+class MappedFile {
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator =(const MappedFile &) = delete;
+
+  const char *Data;
+  std::size_t Size;
+#ifdef _WIN32
+  void *FileHandle;
+  void *MappingHandle;
+#endif
+
+public:
+  explicit MappedFile(StringRef path);
+  ~MappedFile();
+
+  const char *begin() const { return Data; }
+  const char *end() const { return Data + Size; }
+  std::size_t size() const { return Size; }
+
+  StringRef getBuffer() const { return StringRef(Data, Size); }
+};
+
+} // end namespace evelog.
+
+#endif
@@ -0,0 +1,179 @@
+//===- MappedWorkspace.h - Zero copy lbw reader -----------------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares MappedWorkspace, which reads a lbw file through a memory
+// mapping. All strings are StringRefs into the mapping and storage entries are
+// decoded on the fly while iterating, so no memory is allocated per entry.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_MAPPEDWORKSPACE_H
+#define EVELOG_MAPPEDWORKSPACE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "evelog/LBWReader.h"
+#include "evelog/MappedFile.h"
+#include "evelog/StringRef.h"
+
+namespace evelog {
+
+/// StorageEntryRef - A StorageEntry whose data lives in an external buffer.
+struct StorageEntryRef {
+  uint16_t ChannelID;
+  uint32_t ThreadID;
+  uint64_t TimeStamp;
+  StringRef Data;
+  uint32_t ProcessID;
+};
+
+/// Decode the storage entry starting at \p ptr. The entry must have already
+/// been bounds checked.
+StorageEntryRef decodeStorageEntry(const char *ptr);
+
+/// Return a pointer to the storage entry following the one at \p ptr. The
+/// entry must have already been bounds checked.
+const char *nextStorageEntry(const char *ptr);
+
+class MappedDevice {
+  friend class MappedWorkspace;
+
+  const Channel *ChannelsBegin;
+  const Channel *ChannelsEnd;
+public:
+  typedef const Channel *channel_iterator;
+
+  channel_iterator begin_channels() const { return ChannelsBegin; }
+  channel_iterator end_channels() const { return ChannelsEnd; }
+
+  StringRef Name;
+  StringRef Description;
+  double Created;
+  double Modified;
+  StringRef FileMappingName;
+  uint32_t FlushRate;
+  uint32_t Capacity;
+  uint32_t ChannelCount;
+};
+
+class MappedStorage {
+  friend class MappedWorkspace;
+
+  const char *EntriesBegin;
+  const char *EntriesEnd;
+public:
+  /// Forward iterator which decodes each entry as it is reached.
+  class entry_iterator {
+    const char *Ptr;
+    const char *End;
+    StorageEntryRef Current;
+
+    void decode() {
+      if (Ptr != End)
+        Current = decodeStorageEntry(Ptr);
+    }
+
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef StorageEntryRef value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef const StorageEntryRef *pointer;
+    typedef const StorageEntryRef &reference;
+
+    entry_iterator() : Ptr(0), End(0) {}
+    entry_iterator(const char *ptr, const char *end) : Ptr(ptr), End(end) {
+      decode();
+    }
+
+    reference operator *() const { return Current; }
+    pointer operator ->() const { return &Current; }
+
+    entry_iterator &operator ++() {
+      Ptr = nextStorageEntry(Ptr);
+      decode();
+      return *this;
+    }
+
+    entry_iterator operator ++(int) {
+      entry_iterator ret = *this;
+      ++*this;
+      return ret;
+    }
+
+    /// Pointer to the raw bytes of the current entry.
+    const char *getPtr() const { return Ptr; }
+
+    bool operator ==(const entry_iterator &other) const {
+      return Ptr == other.Ptr;
+    }
+    bool operator !=(const entry_iterator &other) const {
+      return Ptr != other.Ptr;
+    }
+  };
+
+  entry_iterator begin_entries() const {
+    return entry_iterator(EntriesBegin, EntriesEnd);
+  }
+  entry_iterator end_entries() const {
+    return entry_iterator(EntriesEnd, EntriesEnd);
+  }
+
+  /// The raw bytes of all of the entries.
+  StringRef getEntries() const {
+    return StringRef(EntriesBegin, EntriesEnd - EntriesBegin);
+  }
+
+  StringRef Name;
+  StringRef Description;
+  double Created;
+  double Modified;
+  uint32_t InitialCapacity;
+  uint32_t IncrementalCapacity;
+  uint32_t EntryCount;
+};
+
+/// MappedWorkspace - A Workspace read through a memory mapping. The
+/// structure of the file is validated when it is opened, and all the views it
+/// hands out are valid for as long as the MappedWorkspace is alive.
+class MappedWorkspace {
+  MappedFile File;
+  std::vector<MappedDevice> Devices;
+  std::vector<MappedStorage> Stores;
+
+  void parse();
+
+public:
+  /// Map and validate the lbw file at \p path. Throws std::system_error if the
+  /// file can not be mapped and parse_error if it is malformed.
+  explicit MappedWorkspace(StringRef path);
+
+  typedef std::vector<MappedDevice>::const_iterator device_iterator;
+  typedef std::vector<MappedStorage>::const_iterator storage_iterator;
+
+  device_iterator begin_devices() const { return Devices.begin(); }
+  device_iterator end_devices() const { return Devices.end(); }
+
+  storage_iterator begin_stores() const { return Stores.begin(); }
+  storage_iterator end_stores() const { return Stores.end(); }
+
+  StringRef getBuffer() const { return File.getBuffer(); }
+
+  StringRef Name;
+  StringRef Description;
+  double Created;
+  double Modified;
+  StringRef FilePath;
+};
+
+} // end namespace evelog.
+
+#endif
@@ -0,0 +1,81 @@
+//===- Parallel.h - Spread a loop over threads ------------------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares parallelFor, which runs the iterations of a loop on a
+// short lived pool of threads.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_PARALLEL_H
+#define EVELOG_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace evelog {
+
+/// Call \p fn(i) for each i in [0, count) on up to \p num_threads threads.
+/// If \p num_threads is 0 one thread per hardware thread is used. The calling
+/// thread takes part, so this works even if no thread can be started.
+///
+/// Iterations are handed out one at a time, so each should be a decent chunk
+/// of work. The first exception thrown by \p fn stops the remaining
+/// iterations and is rethrown once every thread is done.
+template<typename Fn>
+void parallelFor(std::size_t count, unsigned num_threads, Fn fn) {
+  std::atomic<std::size_t> next(0);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  auto worker = [&]() {
+    try {
+      for (;;) {
+        std::size_t i = next.fetch_add(1);
+        if (i >= count)
+          return;
+        fn(i);
+      }
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error)
+        error = std::current_exception();
+      // Stop everyone else as soon as possible.
+      next = count;
+    }
+  };
+
+  if (num_threads == 0)
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  num_threads = unsigned(std::min<std::size_t>(num_threads, count));
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 1; i < num_threads; ++i) {
+    try {
+      threads.push_back(std::thread(worker));
+    } catch (const std::system_error &) {
+      break; // Make do with the threads we have.
+    }
+  }
+  worker();
+  for (std::size_t i = 0; i != threads.size(); ++i)
+    threads[i].join();
+
+  if (error)
+    std::rethrow_exception(error);
+}
+
+} // end namespace evelog.
+
+#endif
@@ -0,0 +1,81 @@
+//===- ProcessModules.h - Per channel process module lists ------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares ProcessModuleTable, the decoded form of the process
+// module lists which follow each device's channel table.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_PROCESSMODULES_H
+#define EVELOG_PROCESSMODULES_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "evelog/StringRef.h"
+
+namespace evelog {
+
+/// ProcessModule - A module of a process which logged to a channel.
+///
+/// The strings point into the ProcessModuleTable which holds the module.
+struct ProcessModule {
+  StringRef Computer;
+  StringRef ProcessName;
+  uint32_t ProcessID;
+  uint32_t ThreadID;
+  StringRef Module;
+};
+
+/// ProcessModuleTable - The process modules of every channel of a device.
+///
+/// Each distinct string is stored once, as the same few computers, processes
+/// and modules repeat across channels. A table can be moved but not copied,
+/// as its modules refer to its strings.
+class ProcessModuleTable {
+  std::unordered_set<std::string> Strings;
+  std::vector<ProcessModule> Modules;
+  /// Index of the first module of each channel, and one past the last module
+  /// of the last channel.
+  std::vector<std::size_t> ChannelStarts;
+
+  ProcessModuleTable(const ProcessModuleTable &) = delete;
+  ProcessModuleTable &operator =(const ProcessModuleTable &) = delete;
+
+  StringRef intern(StringRef s);
+
+public:
+  typedef std::vector<ProcessModule>::const_iterator iterator;
+
+  /// Decode the raw process module lists of \p channel_count channels, as
+  /// kept by Device. Throws parse_error if they are malformed.
+  ProcessModuleTable(StringRef raw, uint32_t channel_count);
+  ProcessModuleTable(ProcessModuleTable &&other);
+  ProcessModuleTable &operator =(ProcessModuleTable &&other);
+
+  std::size_t getChannelCount() const { return ChannelStarts.size() - 1; }
+
+  iterator begin() const { return Modules.begin(); }
+  iterator end() const { return Modules.end(); }
+
+  /// Get the modules of the channel at \p index in the device's channels.
+  iterator begin(std::size_t index) const {
+    return Modules.begin() + ChannelStarts[index];
+  }
+  iterator end(std::size_t index) const {
+    return Modules.begin() + ChannelStarts[index + 1];
+  }
+};
+
+} // end namespace evelog.
+
+#endif
@@ -0,0 +1,118 @@
+//===- Time.h - Convert lbw times to Unix time ------------------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares functions to convert the OLE automation dates used for
+// the Created and Modified times in lbw files, and the FILETIMEs used for
+// storage entry timestamps, to Unix time.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_TIME_H
+#define EVELOG_TIME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace evelog {
+
+/// Returned for times which are NaN, infinite, or can't be represented in
+/// nanoseconds since the Unix epoch.
+const int64_t InvalidUnixTime = std::numeric_limits<int64_t>::min();
+
+/// Convert an OLE automation date to nanoseconds since the Unix epoch.
+///
+/// An OLE date counts days since 1899-12-30. The whole part is the day and the
+/// magnitude of the fraction is the time of day, so -1.25 is 06:00 on
+/// 1899-12-29.
+int64_t oleTimeToUnixNanos(double ole);
+
+/// Convert \p count OLE automation dates at \p in to nanoseconds since the
+/// Unix epoch at \p out.
+void oleTimesToUnixNanos(const double *in, int64_t *out, std::size_t count);
+
+/// Windows FILETIME of the Unix epoch. A FILETIME counts 100ns intervals since
+/// 1601-01-01.
+const uint64_t UnixEpochFileTime = 116444736000000000ULL;
+
+/// Convert a Windows FILETIME, such as StorageEntry::TimeStamp, to nanoseconds
+/// since the Unix epoch. Times which don't fit give InvalidUnixTime.
+inline int64_t fileTimeToUnixNanos(uint64_t filetime) {
+  // Range of FILETIMEs around the epoch whose nanoseconds fit in int64_t.
+  const uint64_t max_ticks =
+    uint64_t(std::numeric_limits<int64_t>::max()) / 100;
+  if (filetime >= UnixEpochFileTime) {
+    uint64_t ticks = filetime - UnixEpochFileTime;
+    return ticks <= max_ticks ? int64_t(ticks * 100) : InvalidUnixTime;
+  }
+  uint64_t ticks = UnixEpochFileTime - filetime;
+  return ticks <= max_ticks ? -int64_t(ticks * 100) : InvalidUnixTime;
+}
+
+/// Convert nanoseconds since the Unix epoch to a Windows FILETIME, rounding
+/// down to a whole 100ns interval. Times before 1601 give 0.
+inline uint64_t unixNanosToFileTime(int64_t nanos) {
+  // Round towards negative infinity.
+  int64_t ticks = nanos / 100 - (nanos % 100 < 0 ? 1 : 0);
+  if (ticks < 0 && uint64_t(-ticks) > UnixEpochFileTime)
+    return 0;
+  return UnixEpochFileTime + uint64_t(ticks);
+}
+
+/// Convert \p count FILETIMEs at \p in to nanoseconds since the Unix epoch at
+/// \p out.
+void fileTimesToUnixNanos(const uint64_t *in, int64_t *out,
+                          std::size_t count);
+
+/// UnixTimes - The Created and Modified times of a workspace, device or
+/// storage in nanoseconds since the Unix epoch.
+struct UnixTimes {
+  int64_t Created;
+  int64_t Modified;
+};
+
+template<typename T>
+UnixTimes getUnixTimes(const T &object) {
+  UnixTimes ut;
+  ut.Created  = oleTimeToUnixNanos(object.Created);
+  ut.Modified = oleTimeToUnixNanos(object.Modified);
+  return ut;
+}
+
+/// Convert the times of \p ws, each of its devices and each of its storages in
+/// one batch. Works with Workspace and MappedWorkspace. \p out is set to the
+/// workspace's times followed by the devices' and then the storages', in
+/// order.
+template<typename WorkspaceT>
+void getUnixTimes(const WorkspaceT &ws, std::vector<UnixTimes> &out) {
+  std::vector<double> ole;
+  ole.push_back(ws.Created);
+  ole.push_back(ws.Modified);
+  for (auto i = ws.begin_devices(), e = ws.end_devices(); i != e; ++i) {
+    ole.push_back(i->Created);
+    ole.push_back(i->Modified);
+  }
+  for (auto i = ws.begin_stores(), e = ws.end_stores(); i != e; ++i) {
+    ole.push_back(i->Created);
+    ole.push_back(i->Modified);
+  }
+
+  std::vector<int64_t> nanos(ole.size());
+  oleTimesToUnixNanos(ole.data(), nanos.data(), ole.size());
+  out.resize(ole.size() / 2);
+  for (std::size_t i = 0; i != out.size(); ++i) {
+    out[i].Created  = nanos[2 * i];
+    out[i].Modified = nanos[2 * i + 1];
+  }
+}
+
+} // end namespace evelog.
+
+#endif
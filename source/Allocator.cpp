@@ -0,0 +1,88 @@
+//===- Allocator.cpp - Bump pointer allocator -------------------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements BumpPtrAllocator.
+//
+//===----------------------------------------------------------------------===//
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include "evelog/Allocator.h"
+
+namespace {
+char *alignPtr(char *ptr, std::size_t alignment) {
+  std::uintptr_t p = reinterpret_cast<std::uintptr_t>(ptr);
+  return reinterpret_cast<char*>((p + alignment - 1) & ~(alignment - 1));
+}
+} // end anon namespace.
+
+namespace evelog {
+
+BumpPtrAllocator::BumpPtrAllocator(std::size_t first_slab_size)
+  : CurSlab(0), CurPtr(0), End(0), NextSlabSize(first_slab_size),
+    BytesAllocated(0) {}
+
+BumpPtrAllocator::~BumpPtrAllocator() {
+  reset();
+}
+
+void BumpPtrAllocator::reset() {
+  while (CurSlab) {
+    Slab *next = CurSlab->Next;
+    std::free(CurSlab);
+    CurSlab = next;
+  }
+  CurPtr = End = 0;
+  BytesAllocated = 0;
+}
+
+void BumpPtrAllocator::startNewSlab(std::size_t min_size) {
+  std::size_t size = NextSlabSize;
+  if (size < min_size + sizeof(Slab))
+    size = min_size + sizeof(Slab);
+
+  Slab *slab = static_cast<Slab*>(std::malloc(size));
+  if (!slab)
+    throw std::bad_alloc();
+  slab->Next = CurSlab;
+  CurSlab = slab;
+  CurPtr = reinterpret_cast<char*>(slab + 1);
+  End = reinterpret_cast<char*>(slab) + size;
+
+  NextSlabSize *= 2;
+}
+
+void BumpPtrAllocator::reserve(std::size_t size) {
+  if (std::size_t(End - CurPtr) < size)
+    startNewSlab(size);
+}
+
+void *BumpPtrAllocator::allocate(std::size_t size, std::size_t alignment) {
+  char *ptr = alignPtr(CurPtr, alignment);
+  if (!CurSlab || ptr > End || std::size_t(End - ptr) < size) {
+    startNewSlab(size + alignment - 1);
+    ptr = alignPtr(CurPtr, alignment);
+  }
+  CurPtr = ptr + size;
+  BytesAllocated += size;
+  return ptr;
+}
+
+StringRef BumpPtrAllocator::save(StringRef str) {
+  if (str.empty())
+    return StringRef();
+  char *mem = static_cast<char*>(allocate(str.size(), 1));
+  std::memcpy(mem, str.data(), str.size());
+  return StringRef(mem, str.size());
+}
+
+} // end namespace evelog.
@@ -0,0 +1,175 @@
+//===- ArenaWorkspace.cpp - Arena allocated lbw reader ----------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements ArenaWorkspace.
+//
+//===----------------------------------------------------------------------===//
+
+#include <cstring>
+#include <new>
+#include <string>
+
+#include "evelog/ArenaWorkspace.h"
+#include "evelog/Endian.h"
+#include "evelog/ProcessModules.h"
+#include "LBWFormat.h"
+
+namespace {
+using namespace evelog::format;
+
+// Reads pstrings into the arena for the stream header readers.
+struct ReadArenaString {
+  evelog::BumpPtrAllocator &Alloc;
+
+  explicit ReadArenaString(evelog::BumpPtrAllocator &alloc) : Alloc(alloc) {}
+
+  evelog::StringRef operator ()(std::istream &is) const {
+    uint8_t size = readPStringSize(is);
+    if (size == 0)
+      return evelog::StringRef();
+    char *mem = Alloc.allocate<char>(size);
+    is.read(mem, size);
+    return evelog::StringRef(mem, size);
+  }
+};
+
+template<typename T>
+T *allocateArray(evelog::BumpPtrAllocator &alloc, std::size_t num) {
+  T *mem = alloc.allocate<T>(num);
+  for (std::size_t i = 0; i != num; ++i)
+    new (mem + i) T();
+  return mem;
+}
+
+// Throw unless count records of at least min_size bytes fit between the
+// stream's position and end.
+void checkStreamCount(std::istream &is, std::istream::pos_type end,
+                      uint32_t count, std::size_t min_size) {
+  std::istream::pos_type pos = is.tellg();
+  if (pos == std::istream::pos_type(-1) || pos > end)
+    throw evelog::parse_error("unexpected end of stream");
+  checkCount(count, min_size, uint64_t(end - pos));
+}
+
+// Entries are read without asking the stream where it is, so their length is
+// only checked against the size of the whole stream.
+void readEntry(std::istream &is, evelog::BumpPtrAllocator &alloc,
+               uint64_t stream_size, evelog::StorageEntryRef &se) {
+  evelog::ulittle16_t channel_id;
+  evelog::ulittle32_t thread_id;
+  evelog::ulittle64_t timestamp;
+  evelog::ulittle32_t len;
+  evelog::ulittle32_t process_id;
+
+  is >> channel_id;
+  is >> thread_id;
+  is >> timestamp;
+  is.seekg(4, std::ios::cur); // Skip unknown bytes.
+  is >> len;
+  if (!is || len > stream_size)
+    throw evelog::parse_error("unexpected end of stream");
+  char *data = len > 0 ? alloc.allocate<char>(len) : 0;
+  is.read(data, len);
+  is >> process_id;
+  is.seekg(4, std::ios::cur); // Skip unknown bytes.
+
+  se.ChannelID = channel_id;
+  se.ThreadID  = thread_id;
+  se.TimeStamp = timestamp;
+  se.Data      = evelog::StringRef(data, len);
+  se.ProcessID = process_id;
+}
+} // end anon namespace.
+
+namespace evelog {
+
+ProcessModuleTable ArenaDevice::getProcessModules() const {
+  if (!hasProcessModules())
+    return ProcessModuleTable(StringRef(), 0);
+  return ProcessModuleTable(ProcessModuleData, ChannelCount);
+}
+
+ArenaWorkspace::ArenaWorkspace()
+  : DevicesBegin(0), DevicesEnd(0), StoresBegin(0), StoresEnd(0), Created(0),
+    Modified(0) {}
+
+std::istream &operator >>(std::istream &is, ArenaWorkspace &ws) {
+  BumpPtrAllocator &alloc = ws.Alloc;
+  alloc.reset();
+  ws.DevicesBegin = ws.DevicesEnd = 0;
+  ws.StoresBegin = ws.StoresEnd = 0;
+
+  // Every count read from the stream is checked against what is left of it
+  // before anything is allocated, which needs the stream's size.
+  std::istream::pos_type start = is.tellg();
+  if (start == std::istream::pos_type(-1))
+    throw parse_error("stream is not seekable");
+  is.seekg(0, std::ios::end);
+  std::istream::pos_type end = is.tellg();
+  if (end == std::istream::pos_type(-1) || !is.seekg(start))
+    throw parse_error("stream is not seekable");
+  uint64_t stream_size = end > start ? uint64_t(end - start) : 0;
+
+  // Get one slab big enough for the whole stream. Entries take a little more
+  // room in memory than on disk.
+  if (stream_size > 0)
+    alloc.reserve(std::size_t(stream_size + stream_size / 2));
+
+  ReadArenaString read_string(alloc);
+  bool keep_modules = getParseOptions(is).KeepProcessModules;
+  std::string modules;
+
+  uint32_t device_count = readWorkspaceHeader(is, ws, read_string);
+  checkStreamCount(is, end, device_count, MinDeviceSize);
+  ArenaDevice *devices = allocateArray<ArenaDevice>(alloc, device_count);
+  for (uint32_t i = 0; i < device_count; ++i) {
+    ArenaDevice &d = devices[i];
+    uint32_t channel_count = readDeviceHeader(is, d, read_string);
+    checkStreamCount(is, end, channel_count, sizeof(Channel));
+    Channel *channels = alloc.allocate<Channel>(channel_count);
+    is.read(reinterpret_cast<char*>(channels), channel_count * sizeof(Channel));
+    d.ChannelsBegin = channels;
+    d.ChannelsEnd   = channels + channel_count;
+    if (keep_modules) {
+      // The lists are copied field by field, so gather them outside the arena
+      // and move them in once their size is known.
+      modules.clear();
+      readProcessModuleLists(is, channel_count, modules);
+      if (!modules.empty()) {
+        char *mem = alloc.allocate<char>(modules.size());
+        std::memcpy(mem, modules.data(), modules.size());
+        d.ProcessModuleData = StringRef(mem, modules.size());
+      }
+    } else
+      skipProcessModuleLists(is, channel_count);
+  }
+  ws.DevicesBegin = devices;
+  ws.DevicesEnd   = devices + device_count;
+
+  uint32_t storage_count = readStorageCount(is);
+  checkStreamCount(is, end, storage_count, MinStorageSize);
+  ArenaStorage *stores = allocateArray<ArenaStorage>(alloc, storage_count);
+  for (uint32_t i = 0; i < storage_count; ++i) {
+    ArenaStorage &s = stores[i];
+    uint32_t entry_count = readStorageHeader(is, s, read_string);
+    checkStreamCount(is, end, entry_count, MinEntrySize);
+    StorageEntryRef *entries =
+      allocateArray<StorageEntryRef>(alloc, entry_count);
+    for (uint32_t e = 0; e < entry_count; ++e)
+      readEntry(is, alloc, stream_size, entries[e]);
+    s.EntriesBegin = entries;
+    s.EntriesEnd   = entries + entry_count;
+  }
+  ws.StoresBegin = stores;
+  ws.StoresEnd   = stores + storage_count;
+
+  return is;
+}
+
+} // end namespace evelog.
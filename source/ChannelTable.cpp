@@ -0,0 +1,75 @@
+//===- ChannelTable.cpp - Resolve channel IDs and hashes --------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements ChannelTable.
+//
+//===----------------------------------------------------------------------===//
+
+#include <limits>
+
+#include "evelog/ChannelTable.h"
+
+namespace evelog {
+
+namespace {
+// FNV-1a. The hashes stored in channels are computed by the logserver in some
+// unknown way, so names are indexed by a hash of our own.
+uint64_t hashName(StringRef name) {
+  uint64_t h = 0xcbf29ce484222325ULL;
+  for (StringRef::iterator i = name.begin(), e = name.end(); i != e; ++i) {
+    h ^= uint8_t(*i);
+    h *= 0x100000001b3ULL;
+  }
+  return h;
+}
+} // end anon namespace.
+
+void ChannelTable::add(const Channel &c) {
+  if (ByID.size() > std::numeric_limits<uint16_t>::max())
+    throw parse_error("too many channels");
+
+  uint16_t id = uint16_t(ByID.size());
+  ByID.push_back(&c);
+  ByHash.insert(std::make_pair(
+    std::make_pair(c.getFacilityHash(), c.getObjectHash()), id));
+  ByFacility.insert(std::make_pair(hashName(c.getFacility()), id));
+  ByObject.insert(std::make_pair(hashName(c.getObject()), id));
+}
+
+uint16_t ChannelTable::findID(uint64_t facility_hash,
+                              uint64_t object_hash) const {
+  auto i = ByHash.find(std::make_pair(facility_hash, object_hash));
+  return i == ByHash.end() ? 0 : i->second;
+}
+
+void ChannelTable::select(const NameIndex &index, StringRef name,
+                          StringRef (Channel::*get)() const,
+                          const std::vector<const Channel *> &by_id,
+                          std::vector<bool> &out) {
+  std::vector<bool> matches(by_id.size());
+  auto range = index.equal_range(hashName(name));
+  for (auto i = range.first; i != range.second; ++i)
+    if ((by_id[i->second]->*get)() == name)
+      matches[i->second] = true;
+  for (std::size_t i = 0, e = out.size(); i != e; ++i)
+    out[i] = out[i] && matches[i];
+}
+
+ChannelSet ChannelTable::select(StringRef facility, StringRef object) const {
+  ChannelSet cs;
+  cs.Members.assign(ByID.size(), true);
+  cs.Members[0] = false;
+  if (!facility.empty())
+    select(ByFacility, facility, &Channel::getFacility, ByID, cs.Members);
+  if (!object.empty())
+    select(ByObject, object, &Channel::getObject, ByID, cs.Members);
+  return cs;
+}
+
+} // end namespace evelog.
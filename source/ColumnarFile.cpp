@@ -0,0 +1,482 @@
+//===- ColumnarFile.cpp - Columnar export of a workspace --------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements writeColumnarFile and ColumnarFile.
+//
+// A columnar file is laid out as follows, all integers little endian:
+//
+//   char     magic[8]        "LBWCOL01"
+//   uint32   version
+//   uint32   column_count
+//   uint64   row_count
+//   uint32   storage_count
+//   uint32   reserved
+//   column   columns[column_count]
+//   uint64   storage_ends[storage_count] one past the last row of each storage
+//
+// followed by the data of each column, 8 byte aligned. Each column is
+//
+//   char     name[16]        null padded
+//   uint8    encoding        0 plain, 1 dictionary, 2 delta
+//   uint8    value_width
+//   uint8    code_width
+//   uint8    reserved
+//   uint32   block_size      rows per checkpoint of a delta column
+//   uint64   value_count
+//   uint64   offset          of the values
+//   uint64   code_size       in bytes
+//
+// and its codes follow its values at the next 8 byte boundary. Columns are
+// found by name, so readers skip columns they do not know.
+//
+// The columns are
+//
+//   channel_id   dictionary of uint16, a code per row
+//   thread_id    dictionary of uint32, a code per row
+//   process_id   dictionary of uint32, a code per row
+//   timestamp    delta, uint64 checkpoints, a signed delta per row
+//   data_offset  plain uint64, row_count + 1 offsets into payload
+//   payload      plain bytes
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "evelog/ColumnarFile.h"
+#include "evelog/Endian.h"
+#include "evelog/LBWReader.h"
+
+namespace {
+using namespace evelog;
+
+const char Magic[8] = {'L', 'B', 'W', 'C', 'O', 'L', '0', '1'};
+const uint32_t Version = 1;
+const uint64_t HeaderSize = 32;
+const uint64_t ColumnSize = 48;
+const std::size_t NameSize = 16;
+const uint32_t DeltaBlockSize = 4096;
+
+const char *const ColumnNames[ColumnarFile::NumColumns] = {
+  "channel_id",
+  "thread_id",
+  "process_id",
+  "timestamp",
+  "data_offset",
+  "payload"
+};
+
+uint64_t alignTo8(uint64_t n) {
+  return (n + 7) & ~uint64_t(7);
+}
+
+/// Smallest of 1, 2 and 4 bytes which can hold codes below \p count.
+uint8_t getCodeWidth(std::size_t count) {
+  if (count <= 0x100)
+    return 1;
+  if (count <= 0x10000)
+    return 2;
+  return 4;
+}
+
+/// Smallest of 1, 2, 4 and 8 bytes which can hold \p v as a signed value.
+uint8_t getDeltaWidth(int64_t v) {
+  if (v >= INT8_MIN && v <= INT8_MAX)
+    return 1;
+  if (v >= INT16_MIN && v <= INT16_MAX)
+    return 2;
+  if (v >= INT32_MIN && v <= INT32_MAX)
+    return 4;
+  return 8;
+}
+
+void writeLE(char *p, uint64_t v, uint8_t width) {
+  switch (width) {
+  case 1: endian::write_le<uint8_t, unaligned>(p, uint8_t(v)); break;
+  case 2: endian::write_le<uint16_t, unaligned>(p, uint16_t(v)); break;
+  case 4: endian::write_le<uint32_t, unaligned>(p, uint32_t(v)); break;
+  default: endian::write_le<uint64_t, unaligned>(p, v); break;
+  }
+}
+
+uint64_t readLE(const char *p, uint8_t width) {
+  switch (width) {
+  case 1: return endian::read_le<uint8_t, unaligned>(p);
+  case 2: return endian::read_le<uint16_t, unaligned>(p);
+  case 4: return endian::read_le<uint32_t, unaligned>(p);
+  default: return endian::read_le<uint64_t, unaligned>(p);
+  }
+}
+
+/// Sign extend a \p width byte delta.
+int64_t readDelta(const char *p, uint8_t width) {
+  switch (width) {
+  case 1: return int8_t(endian::read_le<uint8_t, unaligned>(p));
+  case 2: return int16_t(endian::read_le<uint16_t, unaligned>(p));
+  case 4: return int32_t(endian::read_le<uint32_t, unaligned>(p));
+  default: return int64_t(endian::read_le<uint64_t, unaligned>(p));
+  }
+}
+
+/// A column being written, with its values and codes already encoded.
+struct ColumnWriter {
+  ColumnarFile::Encoding Enc;
+  uint8_t ValueWidth;
+  uint8_t CodeWidth;
+  uint32_t BlockSize;
+  uint64_t ValueCount;
+  std::string Values;
+  std::string Codes;
+};
+
+template<typename T>
+ColumnWriter encodeDictionary(const std::vector<T> &rows) {
+  std::vector<T> dict(rows);
+  std::sort(dict.begin(), dict.end());
+  dict.erase(std::unique(dict.begin(), dict.end()), dict.end());
+
+  // Codes follow the order of the values, so they can be compared in place
+  // of the values.
+  std::unordered_map<T, uint32_t> codes;
+  for (std::size_t i = 0, e = dict.size(); i != e; ++i)
+    codes[dict[i]] = uint32_t(i);
+
+  ColumnWriter cw;
+  cw.Enc = ColumnarFile::Dictionary;
+  cw.ValueWidth = sizeof(T);
+  cw.CodeWidth = getCodeWidth(dict.size());
+  cw.BlockSize = 0;
+  cw.ValueCount = dict.size();
+  cw.Values.resize(dict.size() * sizeof(T));
+  if (!dict.empty())
+    endian::write_le_array(&cw.Values[0], &dict[0], dict.size());
+  cw.Codes.resize(rows.size() * cw.CodeWidth);
+  for (std::size_t i = 0, e = rows.size(); i != e; ++i)
+    writeLE(&cw.Codes[i * cw.CodeWidth], codes[rows[i]], cw.CodeWidth);
+  return cw;
+}
+
+ColumnWriter encodeDelta(const std::vector<uint64_t> &rows) {
+  ColumnWriter cw;
+  cw.Enc = ColumnarFile::Delta;
+  cw.ValueWidth = 8;
+  cw.CodeWidth = 1;
+  cw.BlockSize = DeltaBlockSize;
+  cw.ValueCount = (rows.size() + DeltaBlockSize - 1) / DeltaBlockSize;
+
+  std::vector<uint64_t> checkpoints;
+  std::vector<int64_t> deltas(rows.size());
+  for (std::size_t i = 0, e = rows.size(); i != e; ++i) {
+    if (i % DeltaBlockSize == 0) {
+      checkpoints.push_back(rows[i]);
+      continue;
+    }
+    deltas[i] = int64_t(rows[i] - rows[i - 1]);
+    cw.CodeWidth = std::max(cw.CodeWidth, getDeltaWidth(deltas[i]));
+  }
+
+  cw.Values.resize(checkpoints.size() * 8);
+  if (!checkpoints.empty())
+    endian::write_le_array(&cw.Values[0], &checkpoints[0],
+                           checkpoints.size());
+  cw.Codes.resize(rows.size() * cw.CodeWidth);
+  for (std::size_t i = 0, e = rows.size(); i != e; ++i)
+    writeLE(&cw.Codes[i * cw.CodeWidth], uint64_t(deltas[i]), cw.CodeWidth);
+  return cw;
+}
+
+ColumnWriter makePlain(uint8_t width) {
+  ColumnWriter cw;
+  cw.Enc = ColumnarFile::Plain;
+  cw.ValueWidth = 0;
+  cw.CodeWidth = width;
+  cw.BlockSize = 0;
+  cw.ValueCount = 0;
+  return cw;
+}
+
+void writePadding(std::ostream &os, uint64_t size) {
+  static const char zeros[8] = {};
+  os.write(zeros, std::streamsize(alignTo8(size) - size));
+}
+} // end anon namespace.
+
+namespace evelog {
+
+void writeColumnarFile(const Workspace &ws, std::ostream &os) {
+  std::vector<uint16_t> channel_ids;
+  std::vector<uint32_t> thread_ids;
+  std::vector<uint32_t> process_ids;
+  std::vector<uint64_t> timestamps;
+  std::vector<uint64_t> data_offsets(1, 0);
+  std::vector<uint64_t> storage_ends;
+
+  for (auto s = ws.begin_stores(), se = ws.end_stores(); s != se; ++s) {
+    for (auto i = s->begin_entries(), e = s->end_entries(); i != e; ++i) {
+      channel_ids.push_back(i->ChannelID);
+      thread_ids.push_back(i->ThreadID);
+      process_ids.push_back(i->ProcessID);
+      timestamps.push_back(i->TimeStamp);
+      data_offsets.push_back(data_offsets.back() + i->Data.size());
+    }
+    storage_ends.push_back(channel_ids.size());
+  }
+  uint64_t count = channel_ids.size();
+
+  ColumnWriter columns[ColumnarFile::NumColumns] = {
+    encodeDictionary(channel_ids),
+    encodeDictionary(thread_ids),
+    encodeDictionary(process_ids),
+    encodeDelta(timestamps),
+    makePlain(8),
+    makePlain(1)
+  };
+  ColumnWriter &offsets = columns[ColumnarFile::DataOffsetColumn];
+  offsets.Codes.resize(data_offsets.size() * 8);
+  endian::write_le_array(&offsets.Codes[0], &data_offsets[0],
+                         data_offsets.size());
+  uint64_t offset = alignTo8(HeaderSize +
+                             ColumnarFile::NumColumns * ColumnSize +
+                             storage_ends.size() * 8);
+  std::string header(std::size_t(offset), '\0');
+  char *p = &header[0];
+  std::copy(Magic, Magic + sizeof(Magic), p);
+  endian::write_le<uint32_t, unaligned>(p + 8, Version);
+  endian::write_le<uint32_t, unaligned>(p + 12, ColumnarFile::NumColumns);
+  endian::write_le<uint64_t, unaligned>(p + 16, count);
+  endian::write_le<uint32_t, unaligned>(p + 24, uint32_t(storage_ends.size()));
+
+  for (unsigned c = 0; c != ColumnarFile::NumColumns; ++c) {
+    const ColumnWriter &cw = columns[c];
+    // The payload is written straight from the entries.
+    uint64_t code_size = c == ColumnarFile::PayloadColumn
+                           ? data_offsets.back() : cw.Codes.size();
+    char *d = p + HeaderSize + c * ColumnSize;
+    std::strncpy(d, ColumnNames[c], NameSize);
+    endian::write_le<uint8_t, unaligned>(d + 16, uint8_t(cw.Enc));
+    endian::write_le<uint8_t, unaligned>(d + 17, cw.ValueWidth);
+    endian::write_le<uint8_t, unaligned>(d + 18, cw.CodeWidth);
+    endian::write_le<uint32_t, unaligned>(d + 20, cw.BlockSize);
+    endian::write_le<uint64_t, unaligned>(d + 24, cw.ValueCount);
+    endian::write_le<uint64_t, unaligned>(d + 32, offset);
+    endian::write_le<uint64_t, unaligned>(d + 40, code_size);
+    offset = alignTo8(alignTo8(offset + cw.Values.size()) + code_size);
+  }
+  if (!storage_ends.empty())
+    endian::write_le_array(
+      p + HeaderSize + ColumnarFile::NumColumns * ColumnSize,
+      &storage_ends[0], storage_ends.size());
+  os.write(header.data(), header.size());
+
+  for (unsigned c = 0; c != ColumnarFile::NumColumns; ++c) {
+    const ColumnWriter &cw = columns[c];
+    os.write(cw.Values.data(), cw.Values.size());
+    writePadding(os, cw.Values.size());
+    if (c != ColumnarFile::PayloadColumn) {
+      os.write(cw.Codes.data(), cw.Codes.size());
+      writePadding(os, cw.Codes.size());
+      continue;
+    }
+    for (auto s = ws.begin_stores(), se = ws.end_stores(); s != se; ++s)
+      for (auto i = s->begin_entries(), e = s->end_entries(); i != e; ++i)
+        os.write(i->Data.data(), i->Data.size());
+    writePadding(os, data_offsets.back());
+  }
+}
+
+ColumnarFile::ColumnarFile(StringRef path) : File(path) {
+  using namespace endian;
+  StringRef buffer = File.getBuffer();
+  if (buffer.size() < HeaderSize ||
+      !buffer.startswith(StringRef(Magic, sizeof(Magic))))
+    throw parse_error("not a columnar file");
+  const char *p = buffer.data();
+  if (read_le<uint32_t, unaligned>(p + 8) != Version)
+    throw parse_error("unsupported columnar file version");
+  uint32_t column_count = read_le<uint32_t, unaligned>(p + 12);
+  Count = read_le<uint64_t, unaligned>(p + 16);
+  StorageCount = read_le<uint32_t, unaligned>(p + 24);
+  if ((buffer.size() - HeaderSize) / ColumnSize < column_count ||
+      (buffer.size() - HeaderSize - column_count * ColumnSize) / 8 <
+        StorageCount)
+    throw parse_error("columnar file header runs past the end of the file");
+
+  StorageEnds = p + HeaderSize + column_count * ColumnSize;
+  uint64_t prev_end = 0;
+  for (uint32_t s = 0; s != StorageCount; ++s) {
+    uint64_t end = read_le<uint64_t, unaligned>(StorageEnds + s * 8);
+    if (end < prev_end || end > Count)
+      throw parse_error("columnar file storage out of range");
+    prev_end = end;
+  }
+  if (prev_end != Count)
+    throw parse_error("columnar file storage out of range");
+
+  bool found[NumColumns] = {};
+  for (uint32_t i = 0; i != column_count; ++i) {
+    const char *d = p + HeaderSize + i * ColumnSize;
+    StringRef name(d, strnlen(d, NameSize));
+    unsigned c = 0;
+    while (c != NumColumns && name != ColumnNames[c])
+      ++c;
+    if (c == NumColumns)
+      continue;
+
+    Column &col = Columns[c];
+    uint8_t enc = read_le<uint8_t, unaligned>(d + 16);
+    if (enc > Delta)
+      throw parse_error("columnar file column has an unknown encoding");
+    col.Enc        = Encoding(enc);
+    col.ValueWidth = read_le<uint8_t, unaligned>(d + 17);
+    col.CodeWidth  = read_le<uint8_t, unaligned>(d + 18);
+    col.BlockSize  = read_le<uint32_t, unaligned>(d + 20);
+    col.ValueCount = read_le<uint64_t, unaligned>(d + 24);
+    uint64_t offset = read_le<uint64_t, unaligned>(d + 32);
+    uint64_t code_size = read_le<uint64_t, unaligned>(d + 40);
+
+    if (col.ValueWidth > 8 || col.CodeWidth > 8 ||
+        offset > buffer.size() ||
+        (buffer.size() - offset) / 8 < col.ValueCount)
+      throw parse_error("columnar file column runs past the end of the file");
+    uint64_t codes = alignTo8(offset + col.ValueCount * col.ValueWidth);
+    if (codes > buffer.size() || buffer.size() - codes < code_size)
+      throw parse_error("columnar file column runs past the end of the file");
+    col.Values = StringRef(p + offset,
+                           std::size_t(col.ValueCount * col.ValueWidth));
+    col.Codes = StringRef(p + codes, std::size_t(code_size));
+    found[c] = true;
+  }
+
+  // Check that each column is stored as the decoders expect.
+  struct Expected {
+    Encoding Enc;
+    uint8_t ValueWidth;
+    uint64_t Rows;
+  };
+  const Expected expected[NumColumns] = {
+    { Dictionary, 2, Count },
+    { Dictionary, 4, Count },
+    { Dictionary, 4, Count },
+    { Delta,      8, Count },
+    { Plain,      0, Count + 1 },
+    { Plain,      0, 0 }
+  };
+  for (unsigned c = 0; c != NumColumns; ++c) {
+    const Column &col = Columns[c];
+    const Expected &e = expected[c];
+    if (!found[c])
+      throw parse_error("columnar file is missing a column");
+    bool code_width_ok = col.CodeWidth == 1 || col.CodeWidth == 2 ||
+                         col.CodeWidth == 4 || col.CodeWidth == 8;
+    if (col.Enc != e.Enc || col.ValueWidth != e.ValueWidth || !code_width_ok ||
+        (e.Rows && col.Codes.size() / col.CodeWidth != e.Rows) ||
+        col.Codes.size() % col.CodeWidth != 0 ||
+        (col.Enc == Delta && (col.BlockSize == 0 ||
+           col.ValueCount != (Count + col.BlockSize - 1) / col.BlockSize)))
+      throw parse_error("columnar file column has an unexpected layout");
+  }
+  if (Columns[DataOffsetColumn].CodeWidth != 8 ||
+      Columns[PayloadColumn].CodeWidth != 1)
+    throw parse_error("columnar file column has an unexpected layout");
+}
+
+const char *ColumnarFile::getColumnName(ColumnID c) {
+  return ColumnNames[c];
+}
+
+ColumnarFile::Range ColumnarFile::getStorage(uint32_t s) const {
+  assert(s < StorageCount && "Invalid storage!");
+  Range r;
+  r.Begin = s == 0 ? 0 : endian::read_le<uint64_t, unaligned>(
+                           StorageEnds + (s - 1) * 8);
+  r.End = endian::read_le<uint64_t, unaligned>(StorageEnds + s * 8);
+  return r;
+}
+
+template<typename T>
+void ColumnarFile::decodeDictionary(ColumnID c, uint64_t first, uint64_t count,
+                                    T *out) const {
+  const Column &col = Columns[c];
+  assert(first + count <= Count && "Invalid range!");
+  assert(col.ValueWidth == sizeof(T) && "Wrong value type!");
+
+  // The dictionary is read in place rather than decoded up front, so that
+  // decoding a few rows doesn't cost a pass over every value.
+  const char *values = col.Values.data();
+  const char *codes = col.Codes.data() + first * col.CodeWidth;
+  for (uint64_t i = 0; i != count; ++i) {
+    uint64_t code = readLE(codes + i * col.CodeWidth, col.CodeWidth);
+    if (code >= col.ValueCount)
+      throw parse_error("columnar file dictionary code out of range");
+    out[i] = endian::read_le<T, unaligned>(values + code * sizeof(T));
+  }
+}
+
+void ColumnarFile::getChannelIDs(uint64_t first, uint64_t count,
+                                 uint16_t *out) const {
+  decodeDictionary(ChannelIDColumn, first, count, out);
+}
+
+void ColumnarFile::getThreadIDs(uint64_t first, uint64_t count,
+                                uint32_t *out) const {
+  decodeDictionary(ThreadIDColumn, first, count, out);
+}
+
+void ColumnarFile::getProcessIDs(uint64_t first, uint64_t count,
+                                 uint32_t *out) const {
+  decodeDictionary(ProcessIDColumn, first, count, out);
+}
+
+void ColumnarFile::getTimeStamps(uint64_t first, uint64_t count,
+                                 uint64_t *out) const {
+  const Column &col = Columns[TimeStampColumn];
+  assert(first + count <= Count && "Invalid range!");
+  if (count == 0)
+    return;
+
+  // Start from the checkpoint at or before first.
+  uint64_t row = first - first % col.BlockSize;
+  uint64_t value = 0;
+  for (uint64_t end = first + count; row != end; ++row) {
+    if (row % col.BlockSize == 0)
+      value = endian::read_le<uint64_t, unaligned>(
+        col.Values.data() + row / col.BlockSize * 8);
+    else
+      value += uint64_t(readDelta(col.Codes.data() + row * col.CodeWidth,
+                                  col.CodeWidth));
+    if (row >= first)
+      out[row - first] = value;
+  }
+}
+
+StringRef ColumnarFile::getData(uint64_t n) const {
+  assert(n < Count && "Invalid index!");
+  const char *offsets = Columns[DataOffsetColumn].Codes.data();
+  uint64_t begin = endian::read_le<uint64_t, unaligned>(offsets + n * 8);
+  uint64_t end = endian::read_le<uint64_t, unaligned>(offsets + n * 8 + 8);
+  StringRef payload = getPayload();
+  if (begin > end || end > payload.size())
+    throw parse_error("columnar file data offset out of range");
+  return StringRef(payload.data() + begin, std::size_t(end - begin));
+}
+
+StorageEntryRef ColumnarFile::getEntry(uint64_t n) const {
+  StorageEntryRef ref;
+  getChannelIDs(n, 1, &ref.ChannelID);
+  getThreadIDs(n, 1, &ref.ThreadID);
+  getTimeStamps(n, 1, &ref.TimeStamp);
+  getProcessIDs(n, 1, &ref.ProcessID);
+  ref.Data = getData(n);
+  return ref;
+}
+
+} // end namespace evelog.
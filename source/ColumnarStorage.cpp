@@ -0,0 +1,100 @@
+//===- ColumnarStorage.cpp - Struct of arrays storage entries ---*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements ColumnarStorage.
+//
+//===----------------------------------------------------------------------===//
+
+#include "evelog/ColumnarStorage.h"
+
+namespace evelog {
+
+ColumnarStorage::ColumnarStorage()
+  : DataOffsets(1, 0), Created(0), Modified(0), InitialCapacity(0),
+    IncrementalCapacity(0) {}
+
+ColumnarStorage::ColumnarStorage(const Storage &s)
+  : DataOffsets(1, 0), Name(s.Name), Description(s.Description),
+    Created(s.Created), Modified(s.Modified),
+    InitialCapacity(s.InitialCapacity),
+    IncrementalCapacity(s.IncrementalCapacity) {
+  std::size_t entries = 0;
+  std::size_t payload_bytes = 0;
+  for (auto i = s.begin_entries(), e = s.end_entries(); i != e; ++i) {
+    ++entries;
+    payload_bytes += i->Data.size();
+  }
+  reserve(entries, payload_bytes);
+
+  for (auto i = s.begin_entries(), e = s.end_entries(); i != e; ++i)
+    push_back(*i);
+}
+
+ColumnarStorage::ColumnarStorage(const MappedStorage &s)
+  : DataOffsets(1, 0), Name(s.Name), Description(s.Description),
+    Created(s.Created), Modified(s.Modified),
+    InitialCapacity(s.InitialCapacity),
+    IncrementalCapacity(s.IncrementalCapacity) {
+  // The mapped entries are contiguous, so their total size bounds the
+  // payload.
+  auto b = s.begin_entries(), e = s.end_entries();
+  reserve(s.EntryCount, std::size_t(e.getPtr() - b.getPtr()));
+
+  for (auto i = b; i != e; ++i)
+    push_back(*i);
+}
+
+void ColumnarStorage::clear() {
+  ChannelIDs.clear();
+  ThreadIDs.clear();
+  TimeStamps.clear();
+  ProcessIDs.clear();
+  DataOffsets.assign(1, 0);
+  Payload.clear();
+}
+
+void ColumnarStorage::reserve(std::size_t entries, std::size_t payload_bytes) {
+  ChannelIDs.reserve(entries);
+  ThreadIDs.reserve(entries);
+  TimeStamps.reserve(entries);
+  ProcessIDs.reserve(entries);
+  DataOffsets.reserve(entries + 1);
+  Payload.reserve(payload_bytes);
+}
+
+void ColumnarStorage::appendEntry(uint16_t channel_id, uint32_t thread_id,
+                                  uint64_t timestamp, StringRef data,
+                                  uint32_t process_id) {
+  ChannelIDs.push_back(channel_id);
+  ThreadIDs.push_back(thread_id);
+  TimeStamps.push_back(timestamp);
+  ProcessIDs.push_back(process_id);
+  Payload.append(data.data(), data.size());
+  DataOffsets.push_back(Payload.size());
+}
+
+void ColumnarStorage::push_back(const StorageEntry &se) {
+  appendEntry(se.ChannelID, se.ThreadID, se.TimeStamp, se.Data, se.ProcessID);
+}
+
+void ColumnarStorage::push_back(const StorageEntryRef &se) {
+  appendEntry(se.ChannelID, se.ThreadID, se.TimeStamp, se.Data, se.ProcessID);
+}
+
+StorageEntryRef ColumnarStorage::getEntry(std::size_t i) const {
+  StorageEntryRef se;
+  se.ChannelID = ChannelIDs[i];
+  se.ThreadID  = ThreadIDs[i];
+  se.TimeStamp = TimeStamps[i];
+  se.Data      = getData(i);
+  se.ProcessID = ProcessIDs[i];
+  return se;
+}
+
+} // end namespace evelog.
@@ -0,0 +1,259 @@
+//===- EntryScanner.cpp - Find entries and lines in one pass ----*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements scanEntries and scanText with SSE2 and AVX2 versions
+// chosen at run time, and a portable fallback.
+//
+//===----------------------------------------------------------------------===//
+
+#include "evelog/EntryScanner.h"
+#include "evelog/Endian.h"
+#include "LBWFormat.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define EVELOG_SCANNER_SSE2 1
+# include <emmintrin.h>
+#endif
+
+// AVX2 is compiled with a target attribute so that the rest of the library
+// doesn't require it, and only used if the host supports it.
+#if defined(EVELOG_SCANNER_SSE2) && \
+    (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || __GNUC__ > 4 || \
+     (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+# define EVELOG_SCANNER_AVX2 1
+# include <immintrin.h>
+#endif
+
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+namespace evelog {
+namespace {
+
+inline unsigned popCount(uint32_t v) {
+#if defined(__GNUC__)
+  return __builtin_popcount(v);
+#else
+  v = v - ((v >> 1) & 0x55555555);
+  v = (v & 0x33333333) + ((v >> 2) & 0x33333333);
+  return (((v + (v >> 4)) & 0x0F0F0F0F) * 0x01010101) >> 24;
+#endif
+}
+
+/// Index of the highest set bit. \p v must not be 0.
+inline unsigned highestBit(uint32_t v) {
+#if defined(__GNUC__)
+  return 31 - __builtin_clz(v);
+#elif defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse(&index, v);
+  return index;
+#else
+  unsigned index = 0;
+  while (v >>= 1)
+    ++index;
+  return index;
+#endif
+}
+
+inline bool isTrailingSpace(char c) {
+  return c == '\0' || c == '\n' || c == '\r' || c == ' ' || c == '\t';
+}
+
+/// TextAccumulator - The state of a scan through the text of one entry.
+struct TextAccumulator {
+  /// Newlines seen so far.
+  uint32_t Newlines;
+  /// One past the last byte which isn't trailing space.
+  uint32_t End;
+  /// Newlines before End.
+  uint32_t EndNewlines;
+
+  TextAccumulator() : Newlines(0), End(0), EndNewlines(0) {}
+
+  /// Add a block of bytes starting at \p base, described by bit masks with a
+  /// bit per byte. Returns true if the block contains the terminating NUL.
+  bool addBlock(uint32_t base, uint32_t nul, uint32_t newline,
+                uint32_t content) {
+    bool done = false;
+    if (nul) {
+      // Ignore everything from the first NUL on.
+      uint32_t before = (nul & (0u - nul)) - 1;
+      newline &= before;
+      content &= before;
+      done = true;
+    }
+    if (content) {
+      unsigned last = highestBit(content);
+      End = base + last + 1;
+      EndNewlines = Newlines + popCount(newline & ((uint32_t(1) << last) - 1));
+    }
+    Newlines += popCount(newline);
+    return done;
+  }
+
+  /// Scan [i, size) a byte at a time.
+  TextShape finish(const char *data, uint32_t i, uint32_t size) {
+    for (; i != size; ++i) {
+      char c = data[i];
+      if (c == '\0')
+        break;
+      if (c == '\n')
+        ++Newlines;
+      else if (!isTrailingSpace(c)) {
+        End = i + 1;
+        EndNewlines = Newlines;
+      }
+    }
+    TextShape ts;
+    ts.Size = End;
+    ts.LineCount = End ? EndNewlines + 1 : 0;
+    return ts;
+  }
+};
+
+// The vector scanners finish their tails with TextAccumulator, so this is
+// only needed when there is no SSE2.
+#ifndef EVELOG_SCANNER_SSE2
+TextShape scanTextScalar(const char *data, uint32_t size) {
+  return TextAccumulator().finish(data, 0, size);
+}
+#endif
+
+#ifdef EVELOG_SCANNER_SSE2
+TextShape scanTextSSE2(const char *data, uint32_t size) {
+  const __m128i nul = _mm_setzero_si128();
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i tab = _mm_set1_epi8('\t');
+
+  TextAccumulator acc;
+  uint32_t i = 0;
+  for (; size - i >= 16; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    __m128i is_nul = _mm_cmpeq_epi8(v, nul);
+    __m128i is_newline = _mm_cmpeq_epi8(v, newline);
+    __m128i is_space = _mm_or_si128(
+      _mm_or_si128(is_nul, is_newline),
+      _mm_or_si128(_mm_cmpeq_epi8(v, cr),
+                   _mm_or_si128(_mm_cmpeq_epi8(v, space),
+                                _mm_cmpeq_epi8(v, tab))));
+    if (acc.addBlock(i, uint32_t(_mm_movemask_epi8(is_nul)),
+                     uint32_t(_mm_movemask_epi8(is_newline)),
+                     ~uint32_t(_mm_movemask_epi8(is_space)) & 0xFFFF))
+      return acc.finish(data, i, i);
+  }
+  return acc.finish(data, i, size);
+}
+#endif
+
+#ifdef EVELOG_SCANNER_AVX2
+__attribute__((target("avx2")))
+TextShape scanTextAVX2(const char *data, uint32_t size) {
+  const __m256i nul = _mm256_setzero_si256();
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i tab = _mm256_set1_epi8('\t');
+
+  TextAccumulator acc;
+  uint32_t i = 0;
+  for (; size - i >= 32; i += 32) {
+    __m256i v =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+    __m256i is_nul = _mm256_cmpeq_epi8(v, nul);
+    __m256i is_newline = _mm256_cmpeq_epi8(v, newline);
+    __m256i is_space = _mm256_or_si256(
+      _mm256_or_si256(is_nul, is_newline),
+      _mm256_or_si256(_mm256_cmpeq_epi8(v, cr),
+                      _mm256_or_si256(_mm256_cmpeq_epi8(v, space),
+                                      _mm256_cmpeq_epi8(v, tab))));
+    if (acc.addBlock(i, uint32_t(_mm256_movemask_epi8(is_nul)),
+                     uint32_t(_mm256_movemask_epi8(is_newline)),
+                     ~uint32_t(_mm256_movemask_epi8(is_space))))
+      return acc.finish(data, i, i);
+  }
+  return acc.finish(data, i, size);
+}
+#endif
+
+typedef TextShape (*ScanTextFn)(const char *, uint32_t);
+
+struct Scanner {
+  ScanTextFn Fn;
+  const char *ISA;
+};
+
+Scanner selectScanner() {
+  Scanner s;
+#if defined(EVELOG_SCANNER_AVX2)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    s.Fn = scanTextAVX2;
+    s.ISA = "avx2";
+    return s;
+  }
+#endif
+#if defined(EVELOG_SCANNER_SSE2)
+  s.Fn = scanTextSSE2;
+  s.ISA = "sse2";
+#else
+  s.Fn = scanTextScalar;
+  s.ISA = "scalar";
+#endif
+  return s;
+}
+
+const Scanner &getScanner() {
+  static const Scanner s = selectScanner();
+  return s;
+}
+
+} // end anon namespace.
+
+TextShape scanText(StringRef data) {
+  return getScanner().Fn(data.data(), uint32_t(data.size()));
+}
+
+std::size_t scanEntries(StringRef entries, std::vector<EntryShape> &shapes) {
+  ScanTextFn scan = getScanner().Fn;
+  const char *begin = entries.begin();
+  const char *end = entries.end();
+  std::size_t count = 0;
+
+  for (const char *ptr = begin; ptr != end; ++count) {
+    std::size_t left = std::size_t(end - ptr);
+    if (left < format::EntryHeaderSize)
+      throw parse_error("storage entry header runs past the end of the buffer");
+    uint32_t len = endian::read_le<uint32_t, unaligned>(
+      ptr + format::EntryLengthOffset);
+    if (left - format::EntryHeaderSize <
+        uint64_t(len) + format::EntryTrailerSize)
+      throw parse_error("storage entry runs past the end of the buffer");
+
+    EntryShape es;
+    es.Offset = uint64_t(ptr - begin);
+    es.DataSize = len;
+    es.Text = scan(ptr + format::EntryHeaderSize, len);
+    shapes.push_back(es);
+
+    ptr += format::EntryHeaderSize + len + format::EntryTrailerSize;
+  }
+  return count;
+}
+
+const char *getScannerISA() {
+  return getScanner().ISA;
+}
+
+} // end namespace evelog.
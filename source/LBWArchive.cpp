@@ -0,0 +1,392 @@
+//===- LBWArchive.cpp - Block compressed lbw archives -----------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements writeArchive and LBWArchive.
+//
+// An archive is laid out as follows, all integers little endian:
+//
+//   char     magic[8]        "LBWARC01"
+//   uint32   version
+//   uint32   record_size
+//   uint64   block_count
+//   uint32   storage_count
+//   uint32   reserved
+//   uint64   skeleton_offset
+//   uint64   skeleton_compressed_size
+//   uint64   skeleton_raw_size
+//   uint64   index_offset
+//   byte     blocks[]        each zlib compressed
+//   byte     skeleton[]      zlib compressed
+//   storage  storages[storage_count]  at index_offset
+//   record   records[block_count]
+//
+// The skeleton is the lbw file with every storage's entries cut out. Each
+// storage is
+//
+//   uint64   insert_at       offset in the skeleton of the storage's entries
+//   uint64   first_block
+//   uint64   block_count
+//
+// and each block record is
+//
+//   uint64   offset
+//   uint32   compressed_size
+//   uint32   raw_size
+//   uint32   storage
+//   uint32   entry_count
+//   uint64   min_timestamp
+//   uint64   max_timestamp
+//   uint8    channels[32]    bit set of ChannelID % 256
+//   uint32   crc32           of the uncompressed block
+//   uint32   reserved
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <zlib.h>
+
+#include "evelog/Endian.h"
+#include "evelog/LBWArchive.h"
+#include "evelog/LBWLayout.h"
+#include "evelog/MappedWorkspace.h"
+#include "evelog/Parallel.h"
+#include "LBWFormat.h"
+
+namespace {
+using namespace evelog;
+
+const char Magic[8] = {'L', 'B', 'W', 'A', 'R', 'C', '0', '1'};
+const uint32_t Version = 1;
+const uint64_t HeaderSize = 64;
+const uint64_t StorageSize = 24;
+const uint64_t RecordSize = 80;
+// Deflate can't shrink data by more than about 1032:1. A raw size past that
+// is corrupt, and must not be allowed to size an allocation.
+const uint64_t MaxCompressionRatio = 1032;
+
+std::string compressBytes(StringRef raw, int level) {
+  uLongf size = compressBound(uLong(raw.size()));
+  std::string out(size, '\0');
+  if (compress2(reinterpret_cast<Bytef *>(&out[0]), &size,
+                reinterpret_cast<const Bytef *>(raw.data()),
+                uLong(raw.size()), level) != Z_OK)
+    throw std::runtime_error("zlib compression failed");
+  out.resize(size);
+  return out;
+}
+
+uint32_t getCRC(const char *data, uint64_t size) {
+  return uint32_t(crc32(crc32(0, Z_NULL, 0),
+                        reinterpret_cast<const Bytef *>(data), uInt(size)));
+}
+
+void writeRecord(char *p, const ArchiveBlock &ab) {
+  using namespace endian;
+  write_le<uint64_t, unaligned>(p, ab.Offset);
+  write_le<uint32_t, unaligned>(p + 8, ab.CompressedSize);
+  write_le<uint32_t, unaligned>(p + 12, ab.RawSize);
+  write_le<uint32_t, unaligned>(p + 16, ab.Storage);
+  write_le<uint32_t, unaligned>(p + 20, ab.EntryCount);
+  write_le<uint64_t, unaligned>(p + 24, ab.MinTimeStamp);
+  write_le<uint64_t, unaligned>(p + 32, ab.MaxTimeStamp);
+  std::memcpy(p + 40, ab.Channels, sizeof(ab.Channels));
+  write_le<uint32_t, unaligned>(p + 72, ab.CRC);
+}
+
+ArchiveBlock readRecord(const char *p) {
+  using namespace endian;
+  ArchiveBlock ab;
+  ab.Offset         = read_le<uint64_t, unaligned>(p);
+  ab.CompressedSize = read_le<uint32_t, unaligned>(p + 8);
+  ab.RawSize        = read_le<uint32_t, unaligned>(p + 12);
+  ab.Storage        = read_le<uint32_t, unaligned>(p + 16);
+  ab.EntryCount     = read_le<uint32_t, unaligned>(p + 20);
+  ab.MinTimeStamp   = read_le<uint64_t, unaligned>(p + 24);
+  ab.MaxTimeStamp   = read_le<uint64_t, unaligned>(p + 32);
+  std::memcpy(ab.Channels, p + 40, sizeof(ab.Channels));
+  ab.CRC            = read_le<uint32_t, unaligned>(p + 72);
+  return ab;
+}
+
+/// Append the entries of the uncompressed block \p raw to \p entries.
+void decodeBlock(StringRef raw, const ArchiveBlock &ab,
+                 std::vector<StorageEntry> &entries) {
+  format::BufferReader r(raw.begin(), raw.end());
+  for (uint32_t i = 0; i != ab.EntryCount; ++i) {
+    const char *p = r.getPtr();
+    r.skipEntry();
+    StorageEntryRef ref = decodeStorageEntry(p);
+    entries.push_back(StorageEntry());
+    StorageEntry &se = entries.back();
+    se.ChannelID = ref.ChannelID;
+    se.ThreadID  = ref.ThreadID;
+    se.TimeStamp = ref.TimeStamp;
+    se.Data.assign(ref.Data.data(), ref.Data.size());
+    se.ProcessID = ref.ProcessID;
+  }
+  if (!r.atEnd())
+    throw parse_error("archive block has more data than entries");
+}
+} // end anon namespace.
+
+namespace evelog {
+
+void writeArchive(StringRef buffer, std::ostream &os,
+                  const ArchiveOptions &opts) {
+  LBWLayout layout = scanLayout(buffer);
+  const char *base = buffer.data();
+
+  // Cut the entries out of the file, and split them into blocks.
+  std::string skeleton;
+  std::vector<uint64_t> storage_table;
+  std::vector<ArchiveBlock> blocks;
+  std::vector<ByteRange> block_ranges;
+  uint64_t cursor = 0;
+  for (std::size_t s = 0, se = layout.Stores.size(); s != se; ++s) {
+    const StorageLayout &sl = layout.Stores[s];
+    skeleton.append(base + cursor, std::size_t(sl.Entries.Begin - cursor));
+    cursor = sl.Entries.End;
+    storage_table.push_back(skeleton.size());
+    storage_table.push_back(blocks.size());
+
+    const std::vector<uint64_t> &offsets = sl.EntryOffsets;
+    for (std::size_t e = 0, ee = offsets.size(); e != ee; ) {
+      ArchiveBlock ab;
+      std::memset(&ab, 0, sizeof(ab));
+      ab.Storage = uint32_t(s);
+      ab.MinTimeStamp = std::numeric_limits<uint64_t>::max();
+      ByteRange range = { offsets[e], 0 };
+      do {
+        StorageEntryRef ref = decodeStorageEntry(base + offsets[e]);
+        ab.MinTimeStamp = std::min(ab.MinTimeStamp, ref.TimeStamp);
+        ab.MaxTimeStamp = std::max(ab.MaxTimeStamp, ref.TimeStamp);
+        ab.Channels[(ref.ChannelID & 0xFF) >> 3] |=
+          uint8_t(1 << (ref.ChannelID & 7));
+        ++ab.EntryCount;
+        ++e;
+        range.End = e == ee ? sl.Entries.End : offsets[e];
+      } while (e != ee && range.End - range.Begin < opts.BlockSize);
+      if (range.End - range.Begin > std::numeric_limits<uint32_t>::max())
+        throw parse_error("storage entry too large to archive");
+      ab.RawSize = uint32_t(range.End - range.Begin);
+      blocks.push_back(ab);
+      block_ranges.push_back(range);
+    }
+    storage_table.push_back(blocks.size() - storage_table.back());
+  }
+  skeleton.append(base + cursor, std::size_t(buffer.size() - cursor));
+
+  std::vector<std::string> compressed(blocks.size());
+  parallelFor(blocks.size(), opts.NumThreads, [&](std::size_t b) {
+    StringRef raw(base + block_ranges[b].Begin, blocks[b].RawSize);
+    compressed[b] = compressBytes(raw, opts.Level);
+    blocks[b].CRC = getCRC(raw.data(), raw.size());
+  });
+  std::string compressed_skeleton = compressBytes(skeleton, opts.Level);
+
+  uint64_t offset = HeaderSize;
+  for (std::size_t b = 0, be = blocks.size(); b != be; ++b) {
+    blocks[b].Offset = offset;
+    blocks[b].CompressedSize = uint32_t(compressed[b].size());
+    offset += compressed[b].size();
+  }
+  uint64_t skeleton_offset = offset;
+  uint64_t index_offset = offset + compressed_skeleton.size();
+
+  char header[HeaderSize] = {};
+  std::copy(Magic, Magic + sizeof(Magic), header);
+  endian::write_le<uint32_t, unaligned>(header + 8, Version);
+  endian::write_le<uint32_t, unaligned>(header + 12, uint32_t(RecordSize));
+  endian::write_le<uint64_t, unaligned>(header + 16, blocks.size());
+  endian::write_le<uint32_t, unaligned>(header + 24,
+                                        uint32_t(layout.Stores.size()));
+  endian::write_le<uint64_t, unaligned>(header + 32, skeleton_offset);
+  endian::write_le<uint64_t, unaligned>(header + 40,
+                                        compressed_skeleton.size());
+  endian::write_le<uint64_t, unaligned>(header + 48, skeleton.size());
+  endian::write_le<uint64_t, unaligned>(header + 56, index_offset);
+  os.write(header, sizeof(header));
+
+  for (std::size_t b = 0, be = blocks.size(); b != be; ++b)
+    os.write(compressed[b].data(), compressed[b].size());
+  os.write(compressed_skeleton.data(), compressed_skeleton.size());
+
+  std::string index(std::size_t(storage_table.size() * 8 +
+                                blocks.size() * RecordSize), '\0');
+  if (!storage_table.empty())
+    endian::write_le_array(&index[0], &storage_table[0], storage_table.size());
+  char *records = &index[0] + storage_table.size() * 8;
+  for (std::size_t b = 0, be = blocks.size(); b != be; ++b)
+    writeRecord(records + b * RecordSize, blocks[b]);
+  os.write(index.data(), index.size());
+}
+
+LBWArchive::LBWArchive(StringRef path) : File(path) {
+  using namespace endian;
+  StringRef buffer = File.getBuffer();
+  if (buffer.size() < HeaderSize ||
+      !buffer.startswith(StringRef(Magic, sizeof(Magic))))
+    throw parse_error("not a lbw archive");
+  const char *p = buffer.data();
+  if (read_le<uint32_t, unaligned>(p + 8) != Version ||
+      read_le<uint32_t, unaligned>(p + 12) != RecordSize)
+    throw parse_error("unsupported lbw archive version");
+  uint64_t block_count = read_le<uint64_t, unaligned>(p + 16);
+  uint32_t storage_count = read_le<uint32_t, unaligned>(p + 24);
+  SkeletonOffset = read_le<uint64_t, unaligned>(p + 32);
+  SkeletonCompressedSize = read_le<uint64_t, unaligned>(p + 40);
+  SkeletonRawSize = read_le<uint64_t, unaligned>(p + 48);
+  uint64_t index_offset = read_le<uint64_t, unaligned>(p + 56);
+
+  if (index_offset > buffer.size() ||
+      (buffer.size() - index_offset) / RecordSize < block_count ||
+      buffer.size() - index_offset !=
+        storage_count * StorageSize + block_count * RecordSize ||
+      SkeletonOffset < HeaderSize || SkeletonOffset > index_offset ||
+      index_offset - SkeletonOffset != SkeletonCompressedSize ||
+      SkeletonRawSize > SkeletonCompressedSize * MaxCompressionRatio)
+    throw parse_error("lbw archive index is malformed");
+
+  const char *storages = p + index_offset;
+  const char *records = storages + storage_count * StorageSize;
+  Stores.resize(storage_count);
+  Blocks.resize(std::size_t(block_count));
+  for (uint64_t b = 0; b != block_count; ++b) {
+    ArchiveBlock &ab = Blocks[std::size_t(b)];
+    ab = readRecord(records + b * RecordSize);
+    if (ab.Offset < HeaderSize || ab.Offset > SkeletonOffset ||
+        SkeletonOffset - ab.Offset < ab.CompressedSize ||
+        ab.RawSize > uint64_t(ab.CompressedSize) * MaxCompressionRatio ||
+        ab.Storage >= storage_count)
+      throw parse_error("lbw archive block is out of range");
+  }
+
+  // Each storage owns a run of blocks, and the runs follow each other.
+  uint64_t next_block = 0;
+  uint64_t insert_at = 0;
+  for (uint32_t s = 0; s != storage_count; ++s) {
+    StorageRecord &sr = Stores[s];
+    const char *sp = storages + s * StorageSize;
+    sr.InsertAt   = read_le<uint64_t, unaligned>(sp);
+    sr.FirstBlock = read_le<uint64_t, unaligned>(sp + 8);
+    sr.BlockCount = read_le<uint64_t, unaligned>(sp + 16);
+    if (sr.InsertAt < insert_at || sr.InsertAt > SkeletonRawSize ||
+        sr.FirstBlock != next_block || sr.BlockCount > block_count - next_block)
+      throw parse_error("lbw archive storage is out of range");
+    for (uint64_t b = sr.FirstBlock; b != sr.FirstBlock + sr.BlockCount; ++b)
+      if (Blocks[std::size_t(b)].Storage != s)
+        throw parse_error("lbw archive storage is out of range");
+    insert_at = sr.InsertAt;
+    next_block += sr.BlockCount;
+  }
+  if (next_block != block_count)
+    throw parse_error("lbw archive storage is out of range");
+}
+
+void LBWArchive::decompress(uint64_t offset, uint64_t compressed_size,
+                            char *out, uint64_t raw_size) const {
+  uLongf size = uLongf(raw_size);
+  int ret = uncompress(reinterpret_cast<Bytef *>(out), &size,
+                       reinterpret_cast<const Bytef *>(File.begin() + offset),
+                       uLong(compressed_size));
+  if (ret != Z_OK || size != raw_size)
+    throw parse_error("lbw archive block is corrupt");
+}
+
+std::vector<uint64_t> LBWArchive::findBlocks(uint64_t t0, uint64_t t1) const {
+  std::vector<uint64_t> found;
+  for (std::size_t b = 0, e = Blocks.size(); b != e; ++b)
+    if (Blocks[b].overlaps(t0, t1))
+      found.push_back(b);
+  return found;
+}
+
+void LBWArchive::readBlock(uint64_t b, std::string &raw) const {
+  const ArchiveBlock &ab = Blocks[std::size_t(b)];
+  raw.resize(ab.RawSize);
+  if (ab.RawSize == 0)
+    return;
+  decompress(ab.Offset, ab.CompressedSize, &raw[0], ab.RawSize);
+  if (getCRC(raw.data(), raw.size()) != ab.CRC)
+    throw parse_error("lbw archive block is corrupt");
+}
+
+void LBWArchive::readEntries(uint64_t b,
+                             std::vector<StorageEntry> &entries) const {
+  std::string raw;
+  readBlock(b, raw);
+  decodeBlock(raw, Blocks[std::size_t(b)], entries);
+}
+
+void LBWArchive::readEntries(uint64_t t0, uint64_t t1,
+                             std::vector<StorageEntry> &entries,
+                             unsigned num_threads) const {
+  std::vector<uint64_t> found = findBlocks(t0, t1);
+  std::vector<std::vector<StorageEntry> > decoded(found.size());
+  parallelFor(found.size(), num_threads, [&](std::size_t i) {
+    readEntries(found[i], decoded[i]);
+  });
+
+  for (std::size_t i = 0, e = decoded.size(); i != e; ++i)
+    for (std::size_t j = 0, je = decoded[i].size(); j != je; ++j)
+      if (decoded[i][j].TimeStamp >= t0 && decoded[i][j].TimeStamp <= t1)
+        entries.push_back(std::move(decoded[i][j]));
+}
+
+std::string LBWArchive::extract(unsigned num_threads) const {
+  uint64_t total = SkeletonRawSize;
+  for (std::size_t b = 0, e = Blocks.size(); b != e; ++b)
+    total += Blocks[b].RawSize;
+
+  std::string skeleton(std::size_t(SkeletonRawSize), '\0');
+  if (SkeletonRawSize > 0)
+    decompress(SkeletonOffset, SkeletonCompressedSize, &skeleton[0],
+               SkeletonRawSize);
+
+  // Lay the skeleton out with a gap for each storage's blocks.
+  std::string out(std::size_t(total), '\0');
+  std::vector<uint64_t> block_offsets(Blocks.size());
+  uint64_t from = 0;
+  uint64_t to = 0;
+  for (std::size_t s = 0, se = Stores.size(); s != se; ++s) {
+    const StorageRecord &sr = Stores[s];
+    std::memcpy(&out[0] + to, skeleton.data() + from,
+                std::size_t(sr.InsertAt - from));
+    to += sr.InsertAt - from;
+    from = sr.InsertAt;
+    for (uint64_t b = sr.FirstBlock; b != sr.FirstBlock + sr.BlockCount; ++b) {
+      block_offsets[std::size_t(b)] = to;
+      to += Blocks[std::size_t(b)].RawSize;
+    }
+  }
+  if (SkeletonRawSize > from)
+    std::memcpy(&out[0] + to, skeleton.data() + from,
+                std::size_t(SkeletonRawSize - from));
+
+  parallelFor(Blocks.size(), num_threads, [&](std::size_t b) {
+    const ArchiveBlock &ab = Blocks[b];
+    if (ab.RawSize == 0)
+      return;
+    char *dest = &out[0] + block_offsets[b];
+    decompress(ab.Offset, ab.CompressedSize, dest, ab.RawSize);
+    if (getCRC(dest, ab.RawSize) != ab.CRC)
+      throw parse_error("lbw archive block is corrupt");
+  });
+  return out;
+}
+
+void LBWArchive::readWorkspace(Workspace &ws, unsigned num_threads) const {
+  std::string lbw = extract(num_threads);
+  decodeParallel(lbw, ws, num_threads);
+}
+
+} // end namespace evelog.
@@ -0,0 +1,549 @@
+//===- LBWFormat.h - lbw wire format primitives -----------------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares helpers for decoding lbw primitives out of streams and
+// directly out of memory buffers. It is private to the evelog library.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef EVELOG_LBWFORMAT_H
+#define EVELOG_LBWFORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <limits>
+#include <string>
+
+#include "evelog/Endian.h"
+#include "evelog/LBWReader.h"
+#include "evelog/StringRef.h"
+
+namespace evelog {
+namespace format {
+
+/// Thrown when a buffer ends in the middle of a structure.
+struct end_of_buffer : public parse_error {
+  end_of_buffer() : parse_error("unexpected end of buffer") {}
+};
+
+// Storage entries are a fixed size header, len bytes of data and a fixed size
+// trailer.
+const std::size_t EntryHeaderSize  = 22;
+const std::size_t EntryLengthOffset = 18;
+const std::size_t EntryTrailerSize = 8;
+
+// The smallest a record can be, with empty strings and one byte numbers. They
+// bound the counts read from a file before anything is sized by them.
+const std::size_t MinDeviceSize  = 48;
+const std::size_t MinStorageSize = 54;
+const std::size_t MinEntrySize   = EntryHeaderSize + EntryTrailerSize;
+
+/// Throw unless \p count records of at least \p min_size bytes each fit in
+/// the \p remaining bytes of the file.
+inline void checkCount(uint32_t count, std::size_t min_size,
+                       uint64_t remaining) {
+  if (count > remaining / min_size)
+    throw parse_error("record count is larger than the file");
+}
+
+static_assert(std::numeric_limits<double>::is_iec559 && sizeof(double) == 8,
+              "oletime decoding requires IEEE 754 doubles");
+
+/// Decode the raw bits of a little endian IEEE 754 double. The bits are
+/// copied as is, so every value, including subnormals, round trips exactly.
+inline double decodeOleTime(uint64_t raw) {
+  double result;
+  std::memcpy(&result, &raw, sizeof(result));
+  return result;
+}
+
+/// Decode the fixed size fields of a storage entry from its header.
+inline EntryHeader decodeEntryHeader(const char *header) {
+  using namespace endian;
+  EntryHeader h;
+  h.ChannelID = read_le<uint16_t, unaligned>(header);
+  h.ThreadID  = read_le<uint32_t, unaligned>(header + 2);
+  h.TimeStamp = read_le<uint64_t, unaligned>(header + 6);
+  h.DataSize  = read_le<uint32_t, unaligned>(header + EntryLengthOffset);
+  return h;
+}
+
+//===----------------------------------------------------------------------===//
+// Stream primitives
+//===----------------------------------------------------------------------===//
+
+struct number {
+  std::uint32_t value;
+
+  operator std::uint32_t() const {
+    return value;
+  }
+};
+
+inline std::istream &operator >>(std::istream &i, number &num) {
+  ulittle8_t type;
+  i >> type;
+
+  switch (type) {
+  case 0x02: {
+      ulittle8_t val;
+      i >> val;
+      num.value = val;
+      break;
+    }
+  case 0x03: {
+      ulittle16_t val;
+      i >> val;
+      num.value = val;
+      break;
+    }
+  case 0x04: {
+      ulittle32_t val;
+      i >> val;
+      num.value = val;
+      break;
+    }
+  default:
+    throw parse_error("invalid number type");
+  }
+
+  return i;
+}
+
+/// Read the type and size of a pstring, leaving the stream at its data.
+inline uint8_t readPStringSize(std::istream &is) {
+  ulittle8_t type;
+  is >> type;
+  if (type != 0x06)
+    throw parse_error("invalid string type");
+
+  ulittle8_t size;
+  is >> size;
+  return size;
+}
+
+struct pstring {
+  std::string str;
+
+  operator const std::string &() const {
+    return str;
+  }
+};
+
+inline std::istream &operator >>(std::istream &is, pstring &val) {
+  uint8_t size = readPStringSize(is);
+  val.str.resize(size);
+  if (size > 0)
+    is.read(&val.str[0], size);
+  return is;
+}
+
+// Some weird Windows time value.
+struct oletime {
+  double time;
+};
+
+inline std::istream &operator >>(std::istream &is, oletime &t) {
+  ulittle8_t type;
+  is >> type;
+  if (type != 0x11)
+    throw parse_error("invalid time type");
+
+  ulittle64_t read;
+  is >> read;
+  t.time = decodeOleTime(read);
+
+  return is;
+}
+
+/// Reads pstrings into std::strings for the stream header readers.
+struct ReadStdString {
+  std::string operator ()(std::istream &is) const {
+    pstring val;
+    is >> val;
+    return std::move(val.str);
+  }
+};
+
+// The stream header readers mirror the buffer ones below. They take a
+// function object which reads a pstring and returns a value to store in the
+// string fields.
+
+/// Read the workspace fields up to the device list.
+template<typename WorkspaceT, typename ReadString>
+uint32_t readWorkspaceHeader(std::istream &is, WorkspaceT &ws,
+                             ReadString read_string) {
+  oletime created;
+  oletime modified;
+  number device_count;
+
+  // Skip first two bytes of uselessness.
+  is.seekg(2, std::ios::cur);
+  ws.Name        = read_string(is);
+  ws.Description = read_string(is);
+  is >> created
+     >> modified;
+  ws.FilePath    = read_string(is);
+  is >> device_count;
+
+  ws.Created  = created.time;
+  ws.Modified = modified.time;
+
+  return device_count;
+}
+
+/// Read the number of storages which follows the device list.
+inline uint32_t readStorageCount(std::istream &is) {
+  number storage_count;
+
+  is.seekg(2, std::ios::cur); // Skip unknown bytes.
+  is >> storage_count;
+
+  return storage_count;
+}
+
+/// Read the device fields up to the channel table.
+template<typename DeviceT, typename ReadString>
+uint32_t readDeviceHeader(std::istream &is, DeviceT &d,
+                          ReadString read_string) {
+  oletime created;
+  oletime modified;
+  number  flush_rate;
+  number  capacity;
+  number  unknown;
+  number  channel_count;
+
+  d.Name        = read_string(is);
+  d.Description = read_string(is);
+  is >> created
+     >> modified;
+  is.seekg(8, std::ios::cur); // Skip unknown.
+  d.FileMappingName = read_string(is);
+  is >> flush_rate
+     >> capacity;
+  is.seekg(8, std::ios::cur); // Skip unknown.
+  is >> unknown
+     >> channel_count;
+
+  d.Created      = created.time;
+  d.Modified     = modified.time;
+  d.FlushRate    = flush_rate;
+  d.Capacity     = capacity;
+  d.ChannelCount = channel_count;
+
+  return channel_count;
+}
+
+/// Read the storage fields up to the entry list.
+template<typename StorageT, typename ReadString>
+uint32_t readStorageHeader(std::istream &is, StorageT &s,
+                           ReadString read_string) {
+  oletime created;
+  oletime modified;
+  number  inital_capacity;
+  number  incremental_capacity;
+  number  unknown;
+  number  entry_count;
+
+  s.Name        = read_string(is);
+  s.Description = read_string(is);
+  is >> created
+     >> modified;
+  is.seekg(8, std::ios::cur); // Skip unknown.
+  is >> inital_capacity
+     >> incremental_capacity;
+  is.seekg(10, std::ios::cur); // Skip unknown.
+  is >> unknown;
+  is.seekg(1, std::ios::cur); // Skip unknown.
+  is >> unknown;
+  is.seekg(1, std::ios::cur); // Skip unknown.
+  is >> entry_count
+     >> unknown;
+
+  s.Created             = created.time;
+  s.Modified            = modified.time;
+  s.InitialCapacity     = inital_capacity;
+  s.IncrementalCapacity = incremental_capacity;
+
+  return entry_count;
+}
+
+/// Skip a single storage entry without reading its data.
+inline void skipStorageEntry(std::istream &is) {
+  ulittle32_t len;
+
+  is.seekg(EntryLengthOffset, std::ios::cur);
+  is >> len;
+  is.seekg(len + EntryTrailerSize, std::ios::cur);
+}
+
+/// Skip the process module lists which follow a device's channel table.
+///
+/// The lists are made of many small fields, so they are skipped with ignore()
+/// rather than seekg(), which would throw away the stream's buffer each time.
+inline void skipProcessModuleLists(std::istream &is, uint32_t channel_count) {
+  oletime time;
+  number num;
+  for (uint32_t c = 0; c < channel_count && is; ++c) {
+    is.ignore(readPStringSize(is));
+    is.ignore(readPStringSize(is));
+    is >> time
+       >> time
+       >> num;
+    for (uint32_t m = 0, e = num; m < e && is; ++m) {
+      is.ignore(4); // Skip unknown bytes.
+      is.ignore(readPStringSize(is));
+      is.ignore(readPStringSize(is));
+      is >> num
+         >> num;
+      is.ignore(readPStringSize(is));
+      is.ignore(8); // Skip unknown bytes.
+    }
+  }
+}
+
+//===----------------------------------------------------------------------===//
+// Buffer primitives
+//===----------------------------------------------------------------------===//
+
+/// Bounds checked reader over a memory buffer. Every read throws
+/// end_of_buffer if the buffer is too short and parse_error if the data is
+/// malformed.
+class BufferReader {
+  const char *Begin;
+  const char *Cur;
+  const char *End;
+
+  void need(std::size_t n) const {
+    if (std::size_t(End - Cur) < n)
+      throw end_of_buffer();
+  }
+
+public:
+  BufferReader(const char *begin, const char *end)
+    : Begin(begin), Cur(begin), End(end) {}
+
+  const char *getPtr() const { return Cur; }
+  std::size_t getOffset() const { return Cur - Begin; }
+  std::size_t remaining() const { return End - Cur; }
+  bool atEnd() const { return Cur == End; }
+
+  void skip(std::size_t n) {
+    need(n);
+    Cur += n;
+  }
+
+  /// Return a pointer to the next \p n bytes and advance past them.
+  const char *take(std::size_t n) {
+    need(n);
+    const char *ret = Cur;
+    Cur += n;
+    return ret;
+  }
+
+  template<typename value_type>
+  value_type readLE() {
+    need(sizeof(value_type));
+    value_type ret = endian::read_le<value_type, unaligned>(Cur);
+    Cur += sizeof(value_type);
+    return ret;
+  }
+
+  uint32_t readNumber() {
+    switch (readLE<uint8_t>()) {
+    case 0x02: return readLE<uint8_t>();
+    case 0x03: return readLE<uint16_t>();
+    case 0x04: return readLE<uint32_t>();
+    default:
+      throw parse_error("invalid number type");
+    }
+  }
+
+  StringRef readPString() {
+    if (readLE<uint8_t>() != 0x06)
+      throw parse_error("invalid string type");
+    uint8_t size = readLE<uint8_t>();
+    return StringRef(take(size), size);
+  }
+
+  double readOleTime() {
+    if (readLE<uint8_t>() != 0x11)
+      throw parse_error("invalid time type");
+    return decodeOleTime(readLE<uint64_t>());
+  }
+
+  /// Skip a single storage entry without looking at its data.
+  void skipEntry() {
+    need(EntryHeaderSize);
+    uint32_t len =
+      endian::read_le<uint32_t, unaligned>(Cur + EntryLengthOffset);
+    skip(EntryHeaderSize);
+    skip(len);
+    skip(EntryTrailerSize);
+  }
+};
+
+/// Skip the process module lists which follow a device's channel table.
+inline void skipProcessModuleLists(BufferReader &r, uint32_t channel_count) {
+  for (uint32_t c = 0; c < channel_count; ++c) {
+    r.readPString();
+    r.readPString();
+    r.readOleTime();
+    r.readOleTime();
+    uint32_t count = r.readNumber();
+    for (uint32_t m = 0; m < count; ++m) {
+      r.skip(4); // Skip unknown bytes.
+      r.readPString();
+      r.readPString();
+      r.readNumber();
+      r.readNumber();
+      r.readPString();
+      r.skip(8); // Skip unknown bytes.
+    }
+  }
+}
+
+/// Appends the raw bytes of the fields it reads from a stream to a string.
+class RawFieldCopier {
+  std::istream &IS;
+  std::string &Out;
+
+public:
+  RawFieldCopier(std::istream &is, std::string &out) : IS(is), Out(out) {}
+
+  void copy(std::size_t n) {
+    std::size_t at = Out.size();
+    Out.resize(at + n);
+    IS.read(&Out[at], n);
+  }
+
+  uint8_t copyByte() {
+    copy(1);
+    return uint8_t(Out.back());
+  }
+
+  void copyNumber() {
+    switch (copyByte()) {
+    case 0x02: return copy(1);
+    case 0x03: return copy(2);
+    case 0x04: return copy(4);
+    default:
+      if (IS)
+        throw parse_error("invalid number type");
+    }
+  }
+
+  uint32_t copyNumberValue() {
+    std::size_t at = Out.size();
+    copyNumber();
+    if (!IS)
+      return 0;
+    return BufferReader(Out.data() + at, Out.data() + Out.size()).readNumber();
+  }
+
+  void copyPString() {
+    if (copyByte() != 0x06 && IS)
+      throw parse_error("invalid string type");
+    copy(copyByte());
+  }
+
+  void copyOleTime() {
+    if (copyByte() != 0x11 && IS)
+      throw parse_error("invalid time type");
+    copy(8);
+  }
+};
+
+/// Append the raw bytes of the process module lists which follow a device's
+/// channel table to \p raw, to be decoded later by ProcessModuleTable.
+inline void readProcessModuleLists(std::istream &is, uint32_t channel_count,
+                                   std::string &raw) {
+  RawFieldCopier c(is, raw);
+  for (uint32_t ch = 0; ch < channel_count && is; ++ch) {
+    c.copyPString(); // Name.
+    c.copyPString(); // Description.
+    c.copyOleTime(); // Created.
+    c.copyOleTime(); // Modified.
+    for (uint32_t m = 0, e = c.copyNumberValue(); m < e && is; ++m) {
+      c.copy(4); // Unknown bytes.
+      c.copyPString(); // Computer.
+      c.copyPString(); // Process name.
+      c.copyNumber(); // Process ID.
+      c.copyNumber(); // Thread ID.
+      c.copyPString(); // Module.
+      c.copy(8); // Unknown bytes.
+    }
+  }
+}
+
+// The header readers below fill in the public fields shared by the owning and
+// the mapped classes, and return the number of children which follow.
+
+/// Read the workspace fields up to the device list.
+template<typename WorkspaceT>
+uint32_t readWorkspaceHeader(BufferReader &r, WorkspaceT &ws) {
+  // Skip first two bytes of uselessness.
+  r.skip(2);
+  ws.Name        = r.readPString();
+  ws.Description = r.readPString();
+  ws.Created     = r.readOleTime();
+  ws.Modified    = r.readOleTime();
+  ws.FilePath    = r.readPString();
+  return r.readNumber();
+}
+
+/// Read the number of storages which follows the device list.
+inline uint32_t readStorageCount(BufferReader &r) {
+  r.skip(2); // Skip unknown bytes.
+  return r.readNumber();
+}
+
+/// Read the device fields up to the channel table.
+template<typename DeviceT>
+uint32_t readDeviceHeader(BufferReader &r, DeviceT &d) {
+  d.Name        = r.readPString();
+  d.Description = r.readPString();
+  d.Created     = r.readOleTime();
+  d.Modified    = r.readOleTime();
+  r.skip(8); // Skip unknown.
+  d.FileMappingName = r.readPString();
+  d.FlushRate       = r.readNumber();
+  d.Capacity        = r.readNumber();
+  r.skip(8); // Skip unknown.
+  r.readNumber(); // Unknown.
+  d.ChannelCount = r.readNumber();
+  return d.ChannelCount;
+}
+
+/// Read the storage fields up to the entry list.
+template<typename StorageT>
+uint32_t readStorageHeader(BufferReader &r, StorageT &s) {
+  s.Name        = r.readPString();
+  s.Description = r.readPString();
+  s.Created     = r.readOleTime();
+  s.Modified    = r.readOleTime();
+  r.skip(8); // Skip unknown.
+  s.InitialCapacity     = r.readNumber();
+  s.IncrementalCapacity = r.readNumber();
+  r.skip(10); // Skip unknown.
+  r.readNumber();
+  r.skip(1); // Skip unknown.
+  r.readNumber();
+  r.skip(1); // Skip unknown.
+  uint32_t entry_count = r.readNumber();
+  r.readNumber();
+  return entry_count;
+}
+
+} // end namespace format.
+} // end namespace evelog.
+
+#endif
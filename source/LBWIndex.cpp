@@ -0,0 +1,394 @@
+//===- LBWIndex.cpp - Sidecar offset index for lbw files --------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements LBWIndex and IndexedWorkspace.
+//
+// An index file is laid out as follows, all integers little endian:
+//
+//   char     magic[8]        "LBWIDX01"
+//   uint32   version
+//   uint32   record_size
+//   uint64   source_size
+//   int64    source_mtime    nanoseconds since the epoch
+//   uint64   count
+//   record   records[count]  in file order
+//   uint32   by_time[count]  record numbers sorted by timestamp
+//   uint32   by_channel[count] record numbers sorted by channel, timestamp
+//
+// where each record is
+//
+//   uint64   offset
+//   uint64   timestamp
+//   uint32   thread_id
+//   uint32   process_id
+//   uint32   storage
+//   uint16   channel_id
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <system_error>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "evelog/Endian.h"
+#include "evelog/LBWIndex.h"
+#include "evelog/LBWLayout.h"
+#include "LBWFormat.h"
+
+namespace {
+const char Magic[8] = {'L', 'B', 'W', 'I', 'D', 'X', '0', '1'};
+const uint32_t Version = 1;
+const uint64_t HeaderSize = 40;
+const uint64_t RecordSize = 30;
+
+enum Table {
+  ByTime,
+  ByChannel
+};
+
+uint64_t getTableOffset(Table t, uint64_t count) {
+  uint64_t by_time = HeaderSize + count * RecordSize;
+  return t == ByTime ? by_time : by_time + count * 4;
+}
+
+evelog::IndexEntry readRecord(const char *p) {
+  using namespace evelog::endian;
+  evelog::IndexEntry ie;
+  ie.Offset    = read_le<uint64_t, evelog::unaligned>(p);
+  ie.TimeStamp = read_le<uint64_t, evelog::unaligned>(p + 8);
+  ie.ThreadID  = read_le<uint32_t, evelog::unaligned>(p + 16);
+  ie.ProcessID = read_le<uint32_t, evelog::unaligned>(p + 20);
+  ie.Storage   = read_le<uint32_t, evelog::unaligned>(p + 24);
+  ie.ChannelID = read_le<uint16_t, evelog::unaligned>(p + 28);
+  return ie;
+}
+
+void writeRecord(char *p, const evelog::IndexEntry &ie) {
+  using namespace evelog::endian;
+  write_le<uint64_t, evelog::unaligned>(p, ie.Offset);
+  write_le<uint64_t, evelog::unaligned>(p + 8, ie.TimeStamp);
+  write_le<uint32_t, evelog::unaligned>(p + 16, ie.ThreadID);
+  write_le<uint32_t, evelog::unaligned>(p + 20, ie.ProcessID);
+  write_le<uint32_t, evelog::unaligned>(p + 24, ie.Storage);
+  write_le<uint16_t, evelog::unaligned>(p + 28, ie.ChannelID);
+}
+
+// Find the first position in [0, count) for which less(pos) is false.
+template<typename Less>
+uint64_t partitionPoint(uint64_t count, Less less) {
+  uint64_t first = 0;
+  while (count > 0) {
+    uint64_t step = count / 2;
+    if (less(first + step)) {
+      first += step + 1;
+      count -= step + 1;
+    } else
+      count = step;
+  }
+  return first;
+}
+} // end anon namespace.
+
+namespace evelog {
+
+FileStamp FileStamp::get(StringRef path) {
+  FileStamp fs;
+#ifdef _WIN32
+  struct _stat64 st;
+  if (::_stat64(path.str().c_str(), &st) != 0)
+#else
+  struct stat st;
+  if (::stat(path.str().c_str(), &st) != 0)
+#endif
+    throw std::system_error(errno, std::generic_category(),
+                            "failed to stat " + path.str());
+  fs.Size = st.st_size;
+#ifdef _WIN32
+  fs.ModificationTime = int64_t(st.st_mtime) * 1000000000;
+#else
+  // Whole seconds would miss a file rewritten to the same size within one.
+  fs.ModificationTime =
+    int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+  return fs;
+}
+
+LBWIndex::LBWIndex() : Count(0) {}
+
+LBWIndex::~LBWIndex() {}
+
+std::string LBWIndex::getIndexPath(StringRef lbw_path) {
+  return lbw_path.str() + "idx";
+}
+
+bool LBWIndex::setBuffer(StringRef buffer) {
+  using namespace endian;
+  if (buffer.size() < HeaderSize ||
+      !buffer.startswith(StringRef(Magic, sizeof(Magic))))
+    return false;
+  const char *p = buffer.data();
+  if (read_le<uint32_t, unaligned>(p + 8) != Version ||
+      read_le<uint32_t, unaligned>(p + 12) != RecordSize)
+    return false;
+  uint64_t count = read_le<uint64_t, unaligned>(p + 32);
+  if (count > (buffer.size() - HeaderSize) / (RecordSize + 8) ||
+      getTableOffset(ByChannel, count) + count * 4 != buffer.size())
+    return false;
+
+  Buffer = buffer;
+  Count = count;
+  return true;
+}
+
+FileStamp LBWIndex::getSourceStamp() const {
+  FileStamp fs = {0, 0};
+  if (Buffer.size() >= HeaderSize) {
+    fs.Size = endian::read_le<uint64_t, unaligned>(Buffer.data() + 16);
+    fs.ModificationTime =
+      endian::read_le<int64_t, unaligned>(Buffer.data() + 24);
+  }
+  return fs;
+}
+
+void LBWIndex::build(StringRef buffer, const FileStamp &stamp) {
+  LBWLayout layout = scanLayout(buffer);
+
+  std::vector<IndexEntry> entries;
+  for (std::size_t s = 0, se = layout.Stores.size(); s != se; ++s) {
+    const std::vector<uint64_t> &offsets = layout.Stores[s].EntryOffsets;
+    for (std::size_t e = 0, ee = offsets.size(); e != ee; ++e) {
+      StorageEntryRef ref = decodeStorageEntry(buffer.data() + offsets[e]);
+      IndexEntry ie;
+      ie.Offset    = offsets[e];
+      ie.TimeStamp = ref.TimeStamp;
+      ie.ThreadID  = ref.ThreadID;
+      ie.ProcessID = ref.ProcessID;
+      ie.Storage   = uint32_t(s);
+      ie.ChannelID = ref.ChannelID;
+      entries.push_back(ie);
+    }
+  }
+  if (entries.size() > std::numeric_limits<uint32_t>::max())
+    throw parse_error("too many entries to index");
+
+  uint64_t count = entries.size();
+  std::vector<uint32_t> by_time(count);
+  for (uint64_t i = 0; i != count; ++i)
+    by_time[i] = uint32_t(i);
+  std::vector<uint32_t> by_channel(by_time);
+
+  // Ties are broken by file order so the index is deterministic.
+  std::sort(by_time.begin(), by_time.end(), [&](uint32_t a, uint32_t b) {
+    if (entries[a].TimeStamp != entries[b].TimeStamp)
+      return entries[a].TimeStamp < entries[b].TimeStamp;
+    return a < b;
+  });
+  std::sort(by_channel.begin(), by_channel.end(), [&](uint32_t a, uint32_t b) {
+    if (entries[a].ChannelID != entries[b].ChannelID)
+      return entries[a].ChannelID < entries[b].ChannelID;
+    if (entries[a].TimeStamp != entries[b].TimeStamp)
+      return entries[a].TimeStamp < entries[b].TimeStamp;
+    return a < b;
+  });
+
+  std::string out(getTableOffset(ByChannel, count) + count * 4, '\0');
+  char *p = &out[0];
+  std::copy(Magic, Magic + sizeof(Magic), p);
+  endian::write_le<uint32_t, unaligned>(p + 8, Version);
+  endian::write_le<uint32_t, unaligned>(p + 12, uint32_t(RecordSize));
+  endian::write_le<uint64_t, unaligned>(p + 16, stamp.Size);
+  endian::write_le<int64_t, unaligned>(p + 24, stamp.ModificationTime);
+  endian::write_le<uint64_t, unaligned>(p + 32, count);
+  for (uint64_t i = 0; i != count; ++i)
+    writeRecord(p + HeaderSize + i * RecordSize, entries[i]);
+  if (count > 0) {
+    endian::write_le_array(p + getTableOffset(ByTime, count), &by_time[0],
+                           std::size_t(count));
+    endian::write_le_array(p + getTableOffset(ByChannel, count),
+                           &by_channel[0], std::size_t(count));
+  }
+
+  File.reset();
+  Owned.swap(out);
+  setBuffer(Owned);
+}
+
+bool LBWIndex::open(StringRef index_path, const FileStamp &stamp) {
+  std::unique_ptr<MappedFile> file;
+  try {
+    file.reset(new MappedFile(index_path));
+  } catch (const std::system_error &) {
+    return false;
+  }
+
+  LBWIndex candidate;
+  if (!candidate.setBuffer(file->getBuffer()) ||
+      candidate.getSourceStamp() != stamp)
+    return false;
+
+  File.swap(file);
+  Owned.clear();
+  Buffer = candidate.Buffer;
+  Count = candidate.Count;
+  return true;
+}
+
+void LBWIndex::write(StringRef index_path) const {
+  // Write to a temporary and rename it into place so readers never see a
+  // partial index.
+  std::string tmp_path = index_path.str() + ".tmp";
+  {
+    std::ofstream out(tmp_path.c_str(), std::ios::binary | std::ios::trunc);
+    out.write(Buffer.data(), Buffer.size());
+    out.close();
+    if (!out) {
+      std::remove(tmp_path.c_str());
+      throw std::system_error(std::make_error_code(std::errc::io_error),
+                              "failed to write " + tmp_path);
+    }
+  }
+#ifdef _WIN32
+  // rename doesn't replace existing files on Windows.
+  std::remove(index_path.str().c_str());
+#endif
+  if (std::rename(tmp_path.c_str(), index_path.str().c_str()) != 0) {
+    int err = errno;
+    std::remove(tmp_path.c_str());
+    throw std::system_error(err, std::generic_category(),
+                            "failed to rename " + tmp_path);
+  }
+}
+
+uint32_t LBWIndex::getPosition(uint64_t table, uint64_t pos) const {
+  assert(pos < Count && "Invalid position!");
+  uint32_t n = endian::read_le<uint32_t, unaligned>(
+    Buffer.data() + getTableOffset(Table(table), Count) + pos * 4);
+  // The tables aren't checked when the index is opened, as that would read
+  // all of them.
+  if (n >= Count)
+    throw parse_error("corrupt index table");
+  return n;
+}
+
+void LBWIndex::getTimeStamps(uint64_t first, uint64_t count,
+                             uint64_t *out) const {
+  assert(first + count <= Count && "Invalid range!");
+  endian::read_le_strided(Buffer.data() + HeaderSize + first * RecordSize + 8,
+                          std::size_t(RecordSize), out, std::size_t(count));
+}
+
+void LBWIndex::getThreadIDs(uint64_t first, uint64_t count,
+                            uint32_t *out) const {
+  assert(first + count <= Count && "Invalid range!");
+  endian::read_le_strided(Buffer.data() + HeaderSize + first * RecordSize + 16,
+                          std::size_t(RecordSize), out, std::size_t(count));
+}
+
+void LBWIndex::getChannelIDs(uint64_t first, uint64_t count,
+                             uint16_t *out) const {
+  assert(first + count <= Count && "Invalid range!");
+  endian::read_le_strided(Buffer.data() + HeaderSize + first * RecordSize + 28,
+                          std::size_t(RecordSize), out, std::size_t(count));
+}
+
+void LBWIndex::getTimeOrder(uint64_t first, uint64_t count,
+                            uint32_t *out) const {
+  assert(first + count <= Count && "Invalid range!");
+  endian::read_le_array(Buffer.data() + getTableOffset(ByTime, Count) +
+                          first * 4, out, std::size_t(count));
+  for (uint64_t i = 0; i != count; ++i)
+    if (out[i] >= Count)
+      throw parse_error("corrupt index table");
+}
+
+IndexEntry LBWIndex::getEntry(uint64_t n) const {
+  assert(n < Count && "Invalid index!");
+  return readRecord(Buffer.data() + HeaderSize + n * RecordSize);
+}
+
+IndexEntry LBWIndex::getEntryByTime(uint64_t pos) const {
+  return getEntry(getPosition(ByTime, pos));
+}
+
+IndexEntry LBWIndex::getEntryByChannel(uint64_t pos) const {
+  return getEntry(getPosition(ByChannel, pos));
+}
+
+LBWIndex::Range LBWIndex::findTimeRange(uint64_t t0, uint64_t t1) const {
+  Range r;
+  r.Begin = partitionPoint(Count, [&](uint64_t pos) {
+    return getEntryByTime(pos).TimeStamp < t0;
+  });
+  r.End = partitionPoint(Count, [&](uint64_t pos) {
+    return getEntryByTime(pos).TimeStamp <= t1;
+  });
+  if (r.End < r.Begin)
+    r.End = r.Begin;
+  return r;
+}
+
+LBWIndex::Range LBWIndex::findChannel(uint16_t channel) const {
+  return findChannel(channel, 0, std::numeric_limits<uint64_t>::max());
+}
+
+LBWIndex::Range LBWIndex::findChannel(uint16_t channel, uint64_t t0,
+                                      uint64_t t1) const {
+  Range r;
+  r.Begin = partitionPoint(Count, [&](uint64_t pos) {
+    IndexEntry ie = getEntryByChannel(pos);
+    return ie.ChannelID < channel ||
+           (ie.ChannelID == channel && ie.TimeStamp < t0);
+  });
+  r.End = partitionPoint(Count, [&](uint64_t pos) {
+    IndexEntry ie = getEntryByChannel(pos);
+    return ie.ChannelID < channel ||
+           (ie.ChannelID == channel && ie.TimeStamp <= t1);
+  });
+  if (r.End < r.Begin)
+    r.End = r.Begin;
+  return r;
+}
+
+IndexedWorkspace::IndexedWorkspace(StringRef path, bool write_index)
+  : File(path) {
+  FileStamp stamp = FileStamp::get(path);
+  // Describe what was actually mapped in case the file is still growing.
+  stamp.Size = File.size();
+
+  std::string index_path = LBWIndex::getIndexPath(path);
+  if (Index.open(index_path, stamp))
+    return;
+
+  Index.build(File.getBuffer(), stamp);
+  if (write_index) {
+    try {
+      Index.write(index_path);
+    } catch (const std::system_error &) {
+      // The in memory index still works for a read only archive.
+    }
+  }
+}
+
+StorageEntryRef IndexedWorkspace::decodeAt(uint64_t offset) const {
+  if (offset > File.size())
+    throw parse_error("index entry out of range");
+  // Check the framing in case the index doesn't match the file after all.
+  format::BufferReader r(File.begin() + offset, File.end());
+  r.skipEntry();
+  return decodeStorageEntry(File.begin() + offset);
+}
+
+} // end namespace evelog.
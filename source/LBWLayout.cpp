@@ -0,0 +1,160 @@
+//===- LBWLayout.cpp - Structural lbw scanner -------------------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the structural pre-scan and the parallel decoder.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <cstring>
+
+#include "evelog/LBWLayout.h"
+#include "evelog/MappedWorkspace.h"
+#include "evelog/Parallel.h"
+#include "LBWFormat.h"
+
+namespace {
+// Number of entries decoded by a worker in one go. Large enough that the
+// shared counter is rarely touched, small enough to balance uneven storages.
+const std::size_t EntryChunkSize = 4096;
+
+struct EntryChunk {
+  std::size_t Storage;
+  std::size_t Begin;
+  std::size_t End;
+};
+
+// Somewhere for the header readers to put the fields the scan doesn't keep.
+struct DiscardedFields {
+  evelog::StringRef Name;
+  evelog::StringRef Description;
+  double Created;
+  double Modified;
+  evelog::StringRef FilePath;
+  evelog::StringRef FileMappingName;
+  uint32_t FlushRate;
+  uint32_t Capacity;
+  uint32_t ChannelCount;
+  uint32_t InitialCapacity;
+  uint32_t IncrementalCapacity;
+};
+} // end anon namespace.
+
+namespace evelog {
+
+LBWLayout scanLayout(StringRef buffer) {
+  format::BufferReader r(buffer.begin(), buffer.end());
+  LBWLayout layout;
+  DiscardedFields fields;
+
+  layout.Header.Begin = r.getOffset();
+  uint32_t device_count = format::readWorkspaceHeader(r, fields);
+  layout.Header.End = r.getOffset();
+  format::checkCount(device_count, format::MinDeviceSize, r.remaining());
+
+  layout.Devices.resize(device_count);
+  for (uint32_t i = 0; i < device_count; ++i) {
+    ByteRange &d = layout.Devices[i];
+    d.Begin = r.getOffset();
+    uint32_t channel_count = format::readDeviceHeader(r, fields);
+    r.skip(std::size_t(channel_count) * sizeof(Channel));
+    format::skipProcessModuleLists(r, channel_count);
+    d.End = r.getOffset();
+  }
+
+  uint32_t storage_count = format::readStorageCount(r);
+  format::checkCount(storage_count, format::MinStorageSize, r.remaining());
+
+  layout.Stores.resize(storage_count);
+  for (uint32_t i = 0; i < storage_count; ++i) {
+    StorageLayout &s = layout.Stores[i];
+    s.Header.Begin = r.getOffset();
+    uint32_t entry_count = format::readStorageHeader(r, fields);
+    s.Header.End = r.getOffset();
+    format::checkCount(entry_count, format::MinEntrySize, r.remaining());
+
+    s.Entries.Begin = r.getOffset();
+    s.EntryOffsets.resize(entry_count);
+    for (uint32_t e = 0; e < entry_count; ++e) {
+      s.EntryOffsets[e] = r.getOffset();
+      r.skipEntry();
+    }
+    s.Entries.End = r.getOffset();
+  }
+
+  return layout;
+}
+
+void decodeParallel(StringRef buffer, const LBWLayout &layout, Workspace &ws,
+                    unsigned num_threads) {
+  const char *base = buffer.data();
+  // Start from an empty workspace, so nothing of what it held is kept.
+  ws = Workspace();
+
+  // Headers and devices are small, so decode them up front.
+  {
+    format::BufferReader r(base + layout.Header.Begin, buffer.end());
+    format::readWorkspaceHeader(r, ws);
+  }
+
+  ws.Devices.resize(layout.Devices.size());
+  for (std::size_t i = 0, e = layout.Devices.size(); i != e; ++i) {
+    const ByteRange &range = layout.Devices[i];
+    Device &d = ws.Devices[i];
+    format::BufferReader r(base + range.Begin, base + range.End);
+    uint32_t channel_count = format::readDeviceHeader(r, d);
+    d.Channels.resize(channel_count);
+    if (channel_count > 0)
+      std::memcpy( &d.Channels.front()
+                 , r.take(std::size_t(channel_count) * sizeof(Channel))
+                 , channel_count * sizeof(Channel)
+                 );
+  }
+
+  std::vector<EntryChunk> chunks;
+  ws.Stores.resize(layout.Stores.size());
+  for (std::size_t i = 0, e = layout.Stores.size(); i != e; ++i) {
+    const StorageLayout &sl = layout.Stores[i];
+    Storage &s = ws.Stores[i];
+    format::BufferReader r(base + sl.Header.Begin, base + sl.Header.End);
+    format::readStorageHeader(r, s);
+
+    std::size_t entry_count = sl.EntryOffsets.size();
+    s.Entries.resize(entry_count);
+    for (std::size_t b = 0; b < entry_count; b += EntryChunkSize) {
+      EntryChunk c = {i, b, std::min(b + EntryChunkSize, entry_count)};
+      chunks.push_back(c);
+    }
+  }
+
+  parallelFor(chunks.size(), num_threads, [&](std::size_t ci) {
+    const EntryChunk &c = chunks[ci];
+    const std::vector<uint64_t> &offsets =
+      layout.Stores[c.Storage].EntryOffsets;
+    Storage &s = ws.Stores[c.Storage];
+    for (std::size_t ei = c.Begin; ei != c.End; ++ei) {
+      StorageEntryRef ref = decodeStorageEntry(base + offsets[ei]);
+      StorageEntry &se = s.Entries[ei];
+      se.ChannelID = ref.ChannelID;
+      se.ThreadID  = ref.ThreadID;
+      se.TimeStamp = ref.TimeStamp;
+      se.Data.assign(ref.Data.data(), ref.Data.size());
+      se.ProcessID = ref.ProcessID;
+    }
+  });
+
+  for (std::size_t i = 0, e = ws.Stores.size(); i != e; ++i)
+    ws.Stores[i].findRuns();
+}
+
+void decodeParallel(StringRef buffer, Workspace &ws, unsigned num_threads) {
+  decodeParallel(buffer, scanLayout(buffer), ws, num_threads);
+}
+
+} // end namespace evelog.
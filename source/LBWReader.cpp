@@ -11,221 +11,65 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
 
 #include "evelog/LBWReader.h"
 #include "evelog/Endian.h"
+#include "LBWFormat.h"
 
 namespace {
-struct number {
-  std::uint32_t value;
+using namespace evelog::format;
 
-  operator std::uint32_t() const {
-    return value;
-  }
-};
-
-std::istream &operator >>(std::istream &i, number &num) {
-  evelog::ulittle8_t type;
-  i >> type;
-
-  switch (type) {
-  case 0x02: {
-      evelog::ulittle8_t val;
-      i >> val;
-      num.value = val;
-      break;
-    }
-  case 0x03: {
-      evelog::ulittle16_t val;
-      i >> val;
-      num.value = val;
-      break;
-    }
-  case 0x04: {
-      evelog::ulittle32_t val;
-      i >> val;
-      num.value = val;
-      break;
-    }
-  default:
-    throw evelog::parse_error("invalid number type");
-  }
-
-  return i;
-}
-
-struct pstring {
-  std::string str;
-
-  operator const std::string &() const {
-    return str;
-  }
-};
-
-std::istream &operator >>(std::istream &is, pstring &val) {
-  evelog::ulittle8_t type;
-  is >> type;
-  if (type != 0x06)
-    throw evelog::parse_error("invalid string type");
-
-  evelog::ulittle8_t size;
-  is >> size;
-  if (size > 0) {
-    std::vector<char> buf(size);
-    is.read(&buf.front(), size);
-    val.str.reserve(size);
-    val.str.assign(buf.begin(), buf.end());
-  }
-  return is;
+/// The ios_base::iword slot holding a stream's ParseOptions.
+int parseOptionsIndex() {
+  static const int index = std::ios_base::xalloc();
+  return index;
 }
 
-// Some weird Windows time value.
-struct oletime {
-  double time;
+enum ParseOptionFlags {
+  PO_KeepProcessModules = 1 << 0
 };
+} // end annon namespace.
 
-std::istream &operator >>(std::istream &is, oletime &t) {
-  evelog::ulittle8_t type;
-  is >> type;
-  if (type != 0x11)
-    throw evelog::parse_error("invalid time type");
-
-  // Ok, time to decode some IEEE 754-2008!!!!!
-  evelog::ulittle64_t read;
-  is >> read;
-  uint64_t raw = read;
-
-  // Get the parts.
-  uint64_t fraction = raw & ((1LL << 52) - 1);
-  int16_t exponent_raw = (raw >> 52) & ((1LL << 11) - 1);
-  int16_t exponent = exponent_raw - 1023;
-  bool sign = (raw >> 63) == 1;
-
-
-  switch (exponent_raw) {
-  case 0x000: // Zero and subnormals.
-    if (fraction == 0) { // Zero
-      if (sign)
-        t.time = -0.0f;
-      else
-        t.time = 0.0f;
-    } else { // Subnormal
-      throw evelog::parse_error("got subnormal time value!");
-    }
-    break;
-  case 0x7ff: // Infinity and NaN.
-    if (fraction == 0) { // Infinity
-      t.time = std::numeric_limits<double>::infinity();
-      if (sign)
-        t.time = -t.time;
-    } else { // NaN
-      t.time = std::numeric_limits<double>::quiet_NaN();
-    }
-    break;
-  default: { // Normal number.
-      double result = fraction;
-      // Shift down.
-      result /= (1LL << 52);
-      // Add the implicit 1.
-      result += 1.0f;
-      // Handle exponent.
-      int16_t shift = exponent;
-      while (shift > 0) { result *= 2.0; --shift; }
-      while (shift < 0) { result /= 2.0; ++shift; }
-      // Handle sign.
-      if (sign)
-        result *= -1;
-      t.time = result;
-    }
-  }
+namespace evelog {
 
-  return is;
+void setParseOptions(std::ios_base &s, const ParseOptions &opts) {
+  long flags = 0;
+  if (opts.KeepProcessModules)
+    flags |= PO_KeepProcessModules;
+  s.iword(parseOptionsIndex()) = flags;
 }
 
-struct process_module {
-  pstring computer;
-  pstring process_name;
-  number process_id;
-  number thread_id;
-  pstring module;
-};
-
-std::istream &operator >>(std::istream &is, process_module &pm) {
-  is.seekg(4, std::ios::cur); // Skip unknown bytes.
-  is >> pm.computer;
-  is >> pm.process_name;
-  is >> pm.process_id;
-  is >> pm.thread_id;
-  is >> pm.module;
-  is.seekg(8, std::ios::cur); // Skip unknown bytes.
-
-  return is;
+ParseOptions getParseOptions(std::ios_base &s) {
+  long flags = s.iword(parseOptionsIndex());
+  ParseOptions opts;
+  opts.KeepProcessModules = (flags & PO_KeepProcessModules) != 0;
+  return opts;
 }
 
-struct process_module_list {
-  pstring name;
-  pstring description;
-  oletime created;
-  oletime modified;
-  number count;
-  std::vector<process_module> list;
-};
-
-std::istream &operator >>(std::istream &is, process_module_list &pml) {
-  is >> pml.name;
-  is >> pml.description;
-  is >> pml.created;
-  is >> pml.modified;
-  is >> pml.count;
-
-  for (int i = 0; i < pml.count; ++i) {
-    process_module pm;
-    is >> pm;
-    pml.list.push_back(std::move(pm));
-  }
-
-  return is;
+StringRef Channel::getFacility() const {
+  return StringRef(facility, strnlen(facility, sizeof(facility)));
 }
-} // end annon namespace.
 
-namespace evelog {
+StringRef Channel::getObject() const {
+  return StringRef(object, strnlen(object, sizeof(object)));
+}
 
 std::istream &operator >>(std::istream &is, Workspace &ws) {
-  pstring name;
-  pstring description;
-  oletime created;
-  oletime modified;
-  pstring file_path;
-  number device_count;
-  number storage_count;
-
-  // Skip first two bytes of uselessness.
-  is.seekg(2, std::ios::cur);
-  is >> name
-     >> description
-     >> created
-     >> modified
-     >> file_path
-     >> device_count;
-
-  ws.Name        = name;
-  ws.Description = description;
-  ws.Created     = created.time;
-  ws.Modified    = modified.time;
-  ws.FilePath    = file_path;
-
-  for (int i = 0; i < device_count; ++i) {
+  uint32_t device_count = readWorkspaceHeader(is, ws, ReadStdString());
+
+  for (uint32_t i = 0; i < device_count; ++i) {
     Device d;
     is >> d;
     ws.Devices.push_back(std::move(d));
   }
 
-  is.seekg(2, std::ios::cur); // Skip unknown bytes.
-  is >> storage_count;
+  uint32_t storage_count = readStorageCount(is);
 
-  for (int i = 0; i < storage_count; ++i) {
+  for (uint32_t i = 0; i < storage_count; ++i) {
     Storage s;
     is >> s;
     ws.Stores.push_back(std::move(s));
@@ -235,117 +79,171 @@ std::istream &operator >>(std::istream &is, Workspace &ws) {
 }
 
 std::istream &operator >>(std::istream &is, Device &d) {
-  pstring name;
-  pstring description;
-  oletime created;
-  oletime modified;
-  pstring file_mapping_name;
-  number  flush_rate;
-  number  capacity;
-  number  unknown;
-  number  channel_count;
-
-  is >> name
-     >> description
-     >> created
-     >> modified;
-  is.seekg(8, std::ios::cur); // Skip unknown.
-  is >> file_mapping_name
-     >> flush_rate
-     >> capacity;
-  is.seekg(8, std::ios::cur); // Skip unknown.
-  is >> unknown
-     >> channel_count;
-
-  d.Name            = name;
-  d.Description     = description;
-  d.Created         = created.time;
-  d.Modified        = modified.time;
-  d.FileMappingName = file_mapping_name;
-  d.FlushRate       = flush_rate;
-  d.Capacity        = capacity;
+  uint32_t channel_count = readDeviceHeader(is, d, ReadStdString());
 
   d.Channels.resize(channel_count);
-  is.read( reinterpret_cast<char*>(&d.Channels.front())
-         , channel_count * sizeof(Channel)
-         );
-
-  for (int i = 0; i < channel_count; ++i) {
-    process_module_list pml;
-    is >> pml;
-    // Ignore results for now.
-  }
+  if (channel_count > 0)
+    is.read( reinterpret_cast<char*>(&d.Channels.front())
+           , channel_count * sizeof(Channel)
+           );
+
+  d.ProcessModuleData.clear();
+  if (getParseOptions(is).KeepProcessModules)
+    readProcessModuleLists(is, channel_count, d.ProcessModuleData);
+  else
+    skipProcessModuleLists(is, channel_count);
 
   return is;
 }
 
 std::istream &operator >>(std::istream &is, Storage &s) {
-  pstring name;
-  pstring description;
-  oletime created;
-  oletime modified;
-  number  inital_capacity;
-  number  incremental_capacity;
-  number  unknown;
-  number  entry_count;
-
-  is >> name
-     >> description
-     >> created
-     >> modified;
-  is.seekg(8, std::ios::cur); // Skip unknown.
-  is >> inital_capacity
-     >> incremental_capacity;
-  is.seekg(10, std::ios::cur); // Skip unknown.
-  is >> unknown;
-  is.seekg(1, std::ios::cur); // Skip unknown.
-  is >> unknown;
-  is.seekg(1, std::ios::cur); // Skip unknown.
-  is >> entry_count
-     >> unknown;
-
-  s.Name                = name;
-  s.Description         = description;
-  s.Created             = created.time;
-  s.Modified            = modified.time;
-  s.InitialCapacity     = inital_capacity;
-  s.IncrementalCapacity = incremental_capacity;
-
-  for (int i = 0; i < entry_count; ++i) {
+  uint32_t entry_count = readStorageHeader(is, s, ReadStdString());
+
+  for (uint32_t i = 0; i < entry_count; ++i) {
     StorageEntry se;
     is >> se;
     s.Entries.push_back(std::move(se));
   }
+  s.findRuns();
 
   return is;
 }
 
+void Storage::findRuns() {
+  RunStarts.clear();
+  for (std::size_t i = 0, e = Entries.size(); i != e; ++i)
+    if (i == 0 || Entries[i].TimeStamp < Entries[i - 1].TimeStamp)
+      RunStarts.push_back(i);
+}
+
+std::vector<Storage::entry_range>
+Storage::entries_between(uint64_t t0, uint64_t t1) const {
+  std::vector<entry_range> ranges;
+  if (t0 > t1)
+    return ranges;
+
+  for (std::size_t r = 0, e = RunStarts.size(); r != e; ++r) {
+    entry_iterator begin = Entries.begin() + RunStarts[r];
+    entry_iterator end = r + 1 != e ? Entries.begin() + RunStarts[r + 1]
+                                    : Entries.end();
+    // Skip runs which are entirely outside of the range.
+    if (begin->TimeStamp > t1 || (end - 1)->TimeStamp < t0)
+      continue;
+    begin = std::lower_bound(begin, end, t0,
+      [](const StorageEntry &se, uint64_t t) { return se.TimeStamp < t; });
+    end = std::upper_bound(begin, end, t1,
+      [](uint64_t t, const StorageEntry &se) { return t < se.TimeStamp; });
+    ranges.push_back(entry_range(begin, end));
+  }
+  return ranges;
+}
+
 std::istream &operator >>(std::istream &is, StorageEntry &se) {
-  evelog::ulittle16_t channel_id;
-  evelog::ulittle32_t thread_id;
-  evelog::ulittle64_t timestamp;
-  evelog::ulittle32_t len;
-  evelog::ulittle32_t process_id;
-
-  // Read
-  is >> channel_id;
-  is >> thread_id;
-  is >> timestamp;
-  is.seekg(4, std::ios::cur); // Skip unknown bytes.
-  is >> len;
-  std::vector<char> data(len);
-  is.read(&data.front(), len);
-  is >> process_id;
-  is.seekg(4, std::ios::cur); // Skip unknown bytes.
-
-  // Store
-  se.ChannelID = channel_id;
-  se.ThreadID  = thread_id;
-  se.TimeStamp = timestamp;
-  se.Data.assign(data.begin(), data.end());
-  se.ProcessID = process_id;
+  using namespace endian;
+  // The header and trailer are each read in one go and decoded from memory.
+  char header[format::EntryHeaderSize];
+  char trailer[format::EntryTrailerSize];
+
+  if (!is.read(header, sizeof(header)))
+    return is;
+  uint32_t len =
+    read_le<uint32_t, unaligned>(header + format::EntryLengthOffset);
+  se.Data.resize(len);
+  if (len > 0)
+    is.read(&se.Data[0], len);
+  is.read(trailer, sizeof(trailer)); // The last 4 bytes are unknown.
+
+  EntryHeader h = decodeEntryHeader(header);
+  se.ChannelID = h.ChannelID;
+  se.ThreadID  = h.ThreadID;
+  se.TimeStamp = h.TimeStamp;
+  se.ProcessID = read_le<uint32_t, unaligned>(trailer);
 
   return is;
 }
 
+EntryCursor::EntryCursor(std::istream &is)
+  : IS(is), StoragesLeft(0), EntriesLeft(0) {
+  // Seeking fails quietly on a pipe, and would be reported as garbage later.
+  if (IS.tellg() == std::istream::pos_type(-1))
+    throw parse_error("stream is not seekable");
+  uint32_t device_count = readWorkspaceHeader(IS, WS, ReadStdString());
+
+  for (uint32_t i = 0; i < device_count; ++i) {
+    Device d;
+    IS >> d;
+    WS.Devices.push_back(std::move(d));
+  }
+
+  StoragesLeft = readStorageCount(IS);
+  if (!IS)
+    throw parse_error("unexpected end of stream");
+}
+
+bool EntryCursor::nextStorage(Storage &s) {
+  // Skip whatever the caller didn't read of the current storage.
+  for (; EntriesLeft > 0; --EntriesLeft)
+    skipStorageEntry(IS);
+
+  if (StoragesLeft == 0)
+    return false;
+  --StoragesLeft;
+
+  s.Entries.clear();
+  s.RunStarts.clear();
+  EntriesLeft = readStorageHeader(IS, s, ReadStdString());
+  if (!IS)
+    throw parse_error("unexpected end of stream");
+  return true;
+}
+
+bool EntryCursor::nextHeader(EntryHeader &h) {
+  if (EntriesLeft == 0)
+    return false;
+  --EntriesLeft;
+
+  char header[format::EntryHeaderSize];
+  if (!IS.read(header, sizeof(header)))
+    throw parse_error("unexpected end of stream");
+  h = decodeEntryHeader(header);
+  return true;
+}
+
+void EntryCursor::readData(const EntryHeader &h, StorageEntry &se) {
+  char trailer[format::EntryTrailerSize];
+  se.Data.resize(h.DataSize);
+  if (h.DataSize > 0)
+    IS.read(&se.Data[0], h.DataSize);
+  IS.read(trailer, sizeof(trailer)); // The last 4 bytes are unknown.
+  if (!IS)
+    throw parse_error("unexpected end of stream");
+
+  se.ChannelID = h.ChannelID;
+  se.ThreadID  = h.ThreadID;
+  se.TimeStamp = h.TimeStamp;
+  se.ProcessID = endian::read_le<uint32_t, unaligned>(trailer);
+}
+
+void EntryCursor::skipData(const EntryHeader &h) {
+  std::streamoff len = std::streamoff(h.DataSize) + format::EntryTrailerSize;
+  // ignore() keeps the stream's buffer, while seeking throws it away. It
+  // only sets eofbit when it runs out, so count what it skipped.
+  if (h.DataSize < SeekThreshold) {
+    if (IS.ignore(len).gcount() != len)
+      throw parse_error("unexpected end of stream");
+  } else if (!IS.seekg(len, std::ios::cur))
+    throw parse_error("failed to seek past entry data");
+}
+
+bool EntryCursor::nextEntry(StorageEntry &se) {
+  if (EntriesLeft == 0)
+    return false;
+  --EntriesLeft;
+
+  IS >> se;
+  if (!IS)
+    throw parse_error("unexpected end of stream");
+  return true;
+}
+
 }
@@ -0,0 +1,198 @@
+//===- LiveStorageReader.cpp - Follow a growing lbw file --------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements LiveStorageReader.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <sys/stat.h>
+
+#include "evelog/LiveStorageReader.h"
+#include "evelog/MappedWorkspace.h"
+#include "LBWFormat.h"
+
+namespace {
+// Most bytes read from the file before decoding them. Only an entry which is
+// larger than this makes Pending grow past it.
+const std::size_t ReadChunkSize = 1024 * 1024;
+
+// The logserver writes one log message per entry. A length this large can
+// only come from a corrupt header, and would otherwise make Pending hold the
+// rest of the file while waiting for the entry to end.
+const uint32_t MaxEntryDataSize = 16 * 1024 * 1024;
+
+// Get what identifies the file at path apart from its contents. Returns false
+// if it can't be stat'd.
+bool getFileIdentity(const std::string &path,
+                     evelog::LiveStorageReader::FileIdentity &id) {
+#ifdef _WIN32
+  struct _stat64 st;
+  if (::_stat64(path.c_str(), &st) != 0)
+    return false;
+  // There are no inode numbers here, but st_ctime is the creation time.
+  id = std::make_pair(uint64_t(st.st_dev), uint64_t(st.st_ctime));
+#else
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0)
+    return false;
+  id = std::make_pair(uint64_t(st.st_dev), uint64_t(st.st_ino));
+#endif
+  return true;
+}
+} // end anon namespace.
+
+namespace evelog {
+
+LiveStorageReader::LiveStorageReader(std::string path)
+  : Path(std::move(path)), Identity(0, 0), Offset(0),
+    CurState(ReadingHeader), StoragesLeft(0), EntriesLeft(0) {}
+
+void LiveStorageReader::restart() {
+  File.close();
+  File.clear();
+  Pending.clear();
+  Offset = 0;
+  CurState = ReadingHeader;
+  WS = Workspace();
+  CurStorage = Storage();
+  StoragesLeft = EntriesLeft = 0;
+}
+
+std::size_t LiveStorageReader::update(std::vector<StorageEntry> &entries) {
+  FileIdentity id;
+  if (File.is_open() && getFileIdentity(Path, id) && id != Identity)
+    restart(); // Another file was moved over the one being read.
+
+  if (!File.is_open()) {
+    // Stat first, so a file replaced in between is caught by the next call.
+    if (!getFileIdentity(Path, Identity))
+      return 0;
+    File.open(Path.c_str(), std::ios::in | std::ios::binary);
+    if (!File.is_open())
+      return 0;
+  }
+
+  File.clear();
+  File.seekg(0, std::ios::end);
+  std::streamoff size = File.tellg();
+  if (size < 0)
+    throw parse_error("failed to get size of live file");
+
+  uint64_t read_pos = Offset + Pending.size();
+  if (uint64_t(size) < read_pos) {
+    // The file was truncated and rewritten in place. Start over.
+    restart();
+    return update(entries);
+  }
+
+  std::size_t added = 0;
+  File.seekg(std::streamoff(read_pos));
+  while (read_pos < uint64_t(size)) {
+    std::size_t old_size = Pending.size();
+    std::size_t chunk =
+      std::size_t(std::min<uint64_t>(ReadChunkSize, uint64_t(size) - read_pos));
+    Pending.resize(old_size + chunk);
+    File.read(&Pending[old_size], std::streamsize(chunk));
+    Pending.resize(old_size + std::size_t(File.gcount()));
+    if (Pending.size() == old_size)
+      break;
+    read_pos += Pending.size() - old_size;
+    added += decodePending(entries);
+  }
+  return added;
+}
+
+std::size_t
+LiveStorageReader::decodePending(std::vector<StorageEntry> &entries) {
+  format::BufferReader r(Pending.data(), Pending.data() + Pending.size());
+  // Bytes of Pending which belong to fully decoded structures.
+  std::size_t done = 0;
+  std::size_t added = 0;
+
+  try {
+    if (CurState == ReadingHeader) {
+      // The header and devices are small, so they are decoded in one go once
+      // they are all there.
+      Workspace ws;
+      uint32_t device_count = format::readWorkspaceHeader(r, ws);
+      for (uint32_t i = 0; i < device_count; ++i) {
+        Device d;
+        uint32_t channel_count = format::readDeviceHeader(r, d);
+        d.Channels.resize(channel_count);
+        if (channel_count > 0)
+          std::memcpy( &d.Channels.front()
+                     , r.take(std::size_t(channel_count) * sizeof(Channel))
+                     , channel_count * sizeof(Channel)
+                     );
+        format::skipProcessModuleLists(r, channel_count);
+        ws.Devices.push_back(std::move(d));
+      }
+      StoragesLeft = format::readStorageCount(r);
+
+      WS = std::move(ws);
+      CurState = ReadingStorageHeader;
+      done = r.getOffset();
+    }
+
+    for (;;) {
+      if (CurState == ReadingStorageHeader) {
+        if (StoragesLeft == 0)
+          break;
+        Storage s;
+        EntriesLeft = format::readStorageHeader(r, s);
+        --StoragesLeft;
+        CurStorage = std::move(s);
+        CurState = ReadingEntries;
+        done = r.getOffset();
+      }
+
+      if (EntriesLeft == 0 && StoragesLeft > 0) {
+        CurState = ReadingStorageHeader;
+        continue;
+      }
+      if (r.atEnd())
+        break;
+
+      const char *entry = r.getPtr();
+      if (r.remaining() >= format::EntryHeaderSize &&
+          endian::read_le<uint32_t, unaligned>(
+            entry + format::EntryLengthOffset) > MaxEntryDataSize)
+        throw parse_error("entry is too large");
+      r.skipEntry();
+      StorageEntryRef ref = decodeStorageEntry(entry);
+      StorageEntry se;
+      se.ChannelID = ref.ChannelID;
+      se.ThreadID  = ref.ThreadID;
+      se.TimeStamp = ref.TimeStamp;
+      se.Data.assign(ref.Data.data(), ref.Data.size());
+      se.ProcessID = ref.ProcessID;
+      entries.push_back(std::move(se));
+      ++added;
+      if (EntriesLeft > 0)
+        --EntriesLeft;
+      done = r.getOffset();
+    }
+  } catch (const format::end_of_buffer &) {
+    // The rest hasn't been written yet.
+  } catch (...) {
+    Pending.erase(0, done);
+    Offset += done;
+    throw;
+  }
+
+  Pending.erase(0, done);
+  Offset += done;
+  return added;
+}
+
+} // end namespace evelog.
@@ -0,0 +1,127 @@
+//===- MappedFile.cpp - Read only memory mapped file ------------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements MappedFile for POSIX and Windows hosts.
+//
+//===----------------------------------------------------------------------===//
+
+#include <cerrno>
+#include <string>
+#include <system_error>
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+#include "evelog/MappedFile.h"
+
+namespace evelog {
+
+#ifdef _WIN32
+namespace {
+void throwLastError(const std::string &what) {
+  throw std::system_error(::GetLastError(), std::system_category(), what);
+}
+} // end anon namespace.
+
+MappedFile::MappedFile(StringRef path)
+  : Data(0), Size(0), FileHandle(0), MappingHandle(0) {
+  HANDLE file = ::CreateFileA( path.str().c_str()
+                             , GENERIC_READ
+                             , FILE_SHARE_READ | FILE_SHARE_WRITE
+                             , NULL
+                             , OPEN_EXISTING
+                             , FILE_ATTRIBUTE_NORMAL
+                             , NULL
+                             );
+  if (file == INVALID_HANDLE_VALUE)
+    throwLastError("failed to open " + path.str());
+  FileHandle = file;
+
+  LARGE_INTEGER size;
+  if (!::GetFileSizeEx(file, &size)) {
+    ::CloseHandle(file);
+    throwLastError("failed to stat " + path.str());
+  }
+  Size = static_cast<std::size_t>(size.QuadPart);
+  if (Size == 0)
+    return;
+
+  HANDLE mapping = ::CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping == NULL) {
+    ::CloseHandle(file);
+    throwLastError("failed to map " + path.str());
+  }
+  MappingHandle = mapping;
+
+  Data = static_cast<const char*>(
+    ::MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  if (!Data) {
+    ::CloseHandle(mapping);
+    ::CloseHandle(file);
+    throwLastError("failed to map " + path.str());
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (Data)
+    ::UnmapViewOfFile(Data);
+  if (MappingHandle)
+    ::CloseHandle(MappingHandle);
+  if (FileHandle)
+    ::CloseHandle(FileHandle);
+}
+#else
+namespace {
+void throwErrno(const std::string &what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+} // end anon namespace.
+
+MappedFile::MappedFile(StringRef path) : Data(0), Size(0) {
+  int fd = ::open(path.str().c_str(), O_RDONLY);
+  if (fd == -1)
+    throwErrno("failed to open " + path.str());
+
+  struct stat st;
+  if (::fstat(fd, &st) == -1) {
+    int err = errno;
+    ::close(fd);
+    errno = err;
+    throwErrno("failed to stat " + path.str());
+  }
+  Size = static_cast<std::size_t>(st.st_size);
+  if (Size == 0) {
+    ::close(fd);
+    return;
+  }
+
+  void *addr = ::mmap(0, Size, PROT_READ, MAP_SHARED, fd, 0);
+  int err = errno;
+  // The mapping keeps its own reference to the file.
+  ::close(fd);
+  if (addr == MAP_FAILED) {
+    errno = err;
+    throwErrno("failed to map " + path.str());
+  }
+  Data = static_cast<const char*>(addr);
+}
+
+MappedFile::~MappedFile() {
+  if (Data)
+    ::munmap(const_cast<char*>(Data), Size);
+}
+#endif
+
+} // end namespace evelog.
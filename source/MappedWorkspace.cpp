@@ -0,0 +1,78 @@
+//===- MappedWorkspace.cpp - Zero copy lbw reader ---------------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements MappedWorkspace.
+//
+//===----------------------------------------------------------------------===//
+
+#include "evelog/MappedWorkspace.h"
+#include "evelog/Endian.h"
+#include "LBWFormat.h"
+
+namespace evelog {
+
+StorageEntryRef decodeStorageEntry(const char *ptr) {
+  using namespace endian;
+  uint32_t len = read_le<uint32_t, unaligned>(ptr + format::EntryLengthOffset);
+  const char *data = ptr + format::EntryHeaderSize;
+
+  StorageEntryRef se;
+  se.ChannelID = read_le<uint16_t, unaligned>(ptr);
+  se.ThreadID  = read_le<uint32_t, unaligned>(ptr + 2);
+  se.TimeStamp = read_le<uint64_t, unaligned>(ptr + 6);
+  se.Data      = StringRef(data, len);
+  se.ProcessID = read_le<uint32_t, unaligned>(data + len);
+  return se;
+}
+
+const char *nextStorageEntry(const char *ptr) {
+  uint32_t len =
+    endian::read_le<uint32_t, unaligned>(ptr + format::EntryLengthOffset);
+  return ptr + format::EntryHeaderSize + len + format::EntryTrailerSize;
+}
+
+MappedWorkspace::MappedWorkspace(StringRef path) : File(path) {
+  parse();
+}
+
+void MappedWorkspace::parse() {
+  format::BufferReader r(File.begin(), File.end());
+
+  uint32_t device_count = format::readWorkspaceHeader(r, *this);
+  format::checkCount(device_count, format::MinDeviceSize, r.remaining());
+
+  Devices.resize(device_count);
+  for (uint32_t i = 0; i < device_count; ++i) {
+    MappedDevice &d = Devices[i];
+    uint32_t channel_count = format::readDeviceHeader(r, d);
+
+    const char *channels = r.take(std::size_t(channel_count) * sizeof(Channel));
+    d.ChannelsBegin = reinterpret_cast<const Channel*>(channels);
+    d.ChannelsEnd   = d.ChannelsBegin + channel_count;
+
+    format::skipProcessModuleLists(r, channel_count);
+  }
+
+  uint32_t storage_count = format::readStorageCount(r);
+  format::checkCount(storage_count, format::MinStorageSize, r.remaining());
+
+  Stores.resize(storage_count);
+  for (uint32_t i = 0; i < storage_count; ++i) {
+    MappedStorage &s = Stores[i];
+    s.EntryCount = format::readStorageHeader(r, s);
+
+    // Validate the framing of every entry so iteration needs no checks.
+    s.EntriesBegin = r.getPtr();
+    for (uint32_t e = 0; e < s.EntryCount; ++e)
+      r.skipEntry();
+    s.EntriesEnd = r.getPtr();
+  }
+}
+
+} // end namespace evelog.
@@ -0,0 +1,75 @@
+//===- ProcessModules.cpp - Per channel process module lists ----*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements ProcessModuleTable and Device::getProcessModules.
+//
+//===----------------------------------------------------------------------===//
+
+#include "evelog/ProcessModules.h"
+#include "evelog/LBWReader.h"
+#include "LBWFormat.h"
+
+namespace evelog {
+
+ProcessModuleTable::ProcessModuleTable(StringRef raw, uint32_t channel_count) {
+  format::BufferReader r(raw.begin(), raw.end());
+  ChannelStarts.reserve(channel_count + 1);
+
+  try {
+    for (uint32_t c = 0; c < channel_count; ++c) {
+      ChannelStarts.push_back(Modules.size());
+      r.readPString(); // Name.
+      r.readPString(); // Description.
+      r.readOleTime(); // Created.
+      r.readOleTime(); // Modified.
+      uint32_t count = r.readNumber();
+      for (uint32_t m = 0; m < count; ++m) {
+        ProcessModule pm;
+        r.skip(4); // Skip unknown bytes.
+        pm.Computer    = intern(r.readPString());
+        pm.ProcessName = intern(r.readPString());
+        pm.ProcessID   = r.readNumber();
+        pm.ThreadID    = r.readNumber();
+        pm.Module      = intern(r.readPString());
+        r.skip(8); // Skip unknown bytes.
+        Modules.push_back(pm);
+      }
+    }
+  } catch (const format::end_of_buffer &) {
+    throw parse_error("process module lists run past the end of the data");
+  }
+  ChannelStarts.push_back(Modules.size());
+}
+
+ProcessModuleTable::ProcessModuleTable(ProcessModuleTable &&other)
+  : Strings(std::move(other.Strings)), Modules(std::move(other.Modules)),
+    ChannelStarts(std::move(other.ChannelStarts)) {}
+
+ProcessModuleTable &
+ProcessModuleTable::operator =(ProcessModuleTable &&other) {
+  Strings = std::move(other.Strings);
+  Modules = std::move(other.Modules);
+  ChannelStarts = std::move(other.ChannelStarts);
+  return *this;
+}
+
+StringRef ProcessModuleTable::intern(StringRef s) {
+  // The set's nodes never move, so the strings in them stay put as the set
+  // grows and when the table is moved.
+  const std::string &str = *Strings.insert(s.str()).first;
+  return StringRef(str.data(), str.size());
+}
+
+ProcessModuleTable Device::getProcessModules() const {
+  if (!hasProcessModules())
+    return ProcessModuleTable(StringRef(), 0);
+  return ProcessModuleTable(ProcessModuleData, ChannelCount);
+}
+
+} // end namespace evelog.
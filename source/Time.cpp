@@ -0,0 +1,57 @@
+//===- Time.cpp - Convert lbw times to Unix time ----------------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the conversion of OLE automation dates and FILETIMEs to
+// Unix time.
+//
+//===----------------------------------------------------------------------===//
+
+#include <cmath>
+
+#include "evelog/Time.h"
+
+namespace evelog {
+
+namespace {
+// 1970-01-01 as an OLE automation date.
+const int64_t UnixEpochDay = 25569;
+const int64_t NanosPerDay = 86400LL * 1000000000LL;
+// Days on either side of the Unix epoch which fit in int64_t nanoseconds.
+const int64_t MaxDays = 106751;
+} // end anon namespace.
+
+int64_t oleTimeToUnixNanos(double ole) {
+  // Keep the conversion to an integer defined. Also false for NaN.
+  if (!(std::fabs(ole) < double(MaxDays + UnixEpochDay)))
+    return InvalidUnixTime;
+
+  // The day and the time of day are converted separately. The day is exact,
+  // and the time of day keeps the full precision of the fraction instead of
+  // losing it in a product of around 10^18.
+  double day = std::trunc(ole);
+  double time_of_day = std::fabs(ole - day);
+  int64_t days = int64_t(day) - UnixEpochDay;
+  int64_t nanos = std::llround(time_of_day * double(NanosPerDay));
+  if (days < -MaxDays || days >= MaxDays)
+    return InvalidUnixTime;
+  return days * NanosPerDay + nanos;
+}
+
+void fileTimesToUnixNanos(const uint64_t *in, int64_t *out,
+                          std::size_t count) {
+  for (std::size_t i = 0; i != count; ++i)
+    out[i] = fileTimeToUnixNanos(in[i]);
+}
+
+void oleTimesToUnixNanos(const double *in, int64_t *out, std::size_t count) {
+  for (std::size_t i = 0; i != count; ++i)
+    out[i] = oleTimeToUnixNanos(in[i]);
+}
+
+} // end namespace evelog.
@@ -0,0 +1,167 @@
+//===- tools/dir-monitor-bench.cpp - dir_monitor benchmark ------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a benchmark which floods a dir_monitor with file events
+// and measures how quickly they are delivered.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+#include <dir-monitor/dir_monitor.hpp>
+
+typedef std::chrono::steady_clock bench_clock;
+
+namespace {
+struct Bench {
+  boost::asio::io_service io_service;
+  boost::asio::dir_monitor dm;
+  boost::asio::deadline_timer idle_timer;
+  unsigned FileCount;
+  unsigned Events;
+  unsigned Added;
+  std::atomic<bool> WriterDone;
+  bench_clock::time_point LastEvent;
+
+  Bench(unsigned file_count)
+    : dm(io_service), idle_timer(io_service), FileCount(file_count),
+      Events(0), Added(0), WriterDone(false) {}
+
+  void onEvent(const boost::system::error_code &ec,
+               const boost::asio::dir_monitor_event &ev) {
+    if (ec)
+      return;
+    LastEvent = bench_clock::now();
+    ++Events;
+    if (ev.type == boost::asio::dir_monitor_event::added && ++Added == FileCount)
+      return finish();
+    dm.async_monitor(std::bind(&Bench::onEvent, this, std::placeholders::_1,
+                               std::placeholders::_2));
+  }
+
+  // Give up if events stop arriving after the writer is done, which happens
+  // when the kernel queue overflows.
+  void onIdle(const boost::system::error_code &ec) {
+    if (ec)
+      return;
+    if (WriterDone && bench_clock::now() - LastEvent > std::chrono::seconds(1))
+      return finish();
+    armIdleTimer();
+  }
+
+  void armIdleTimer() {
+    idle_timer.expires_from_now(boost::posix_time::milliseconds(250));
+    idle_timer.async_wait(std::bind(&Bench::onIdle, this,
+                                    std::placeholders::_1));
+  }
+
+  void finish() {
+    io_service.stop();
+  }
+};
+
+double toMS(bench_clock::duration d) {
+  return std::chrono::duration<double, std::milli>(d).count();
+}
+
+double toMS(std::clock_t ticks) {
+  return ticks * 1000.0 / CLOCKS_PER_SEC;
+}
+
+// Create and write \p file_count files in \p dir. Each one is an added event
+// followed by modified events.
+void writeFiles(const boost::filesystem::path &dir, unsigned file_count) {
+  for (unsigned i = 0; i < file_count; ++i) {
+    std::ofstream f((dir / ("f" + std::to_string(i) + ".lbw")).c_str());
+    f << "x";
+  }
+}
+
+boost::filesystem::path makeTempDir() {
+  boost::filesystem::path dir = boost::filesystem::temp_directory_path() /
+    boost::filesystem::unique_path("dir-monitor-bench-%%%%-%%%%");
+  boost::filesystem::create_directory(dir);
+  return dir;
+}
+} // end anon namespace.
+
+int main(int argc, char **argv) {
+  unsigned file_count = argc > 1 ? std::atoi(argv[1]) : 20000;
+  if (file_count == 0) {
+    std::cout << "dir-monitor-bench [file count]\n";
+    return 1;
+  }
+
+  // Writing the files costs far more than handling the events, and varies
+  // from run to run, so write them once without a monitor for comparison.
+  // The difference in CPU time is the cost of the monitor.
+  double base_wall, base_cpu;
+  {
+    boost::filesystem::path dir = makeTempDir();
+    bench_clock::time_point start = bench_clock::now();
+    std::clock_t cpu_start = std::clock();
+    writeFiles(dir, file_count);
+    base_cpu = toMS(std::clock() - cpu_start);
+    base_wall = toMS(bench_clock::now() - start);
+    boost::filesystem::remove_all(dir);
+  }
+
+  boost::filesystem::path dir = makeTempDir();
+  bench_clock::time_point start, writer_end, end;
+  std::clock_t cpu_start, cpu_end;
+  unsigned events, added;
+  {
+    Bench b(file_count);
+    b.dm.add_directory(dir.string());
+    b.dm.async_monitor(std::bind(&Bench::onEvent, &b, std::placeholders::_1,
+                                 std::placeholders::_2));
+    b.armIdleTimer();
+
+    start = bench_clock::now();
+    cpu_start = std::clock();
+    b.LastEvent = start;
+    std::thread writer([&]() {
+      writeFiles(dir, file_count);
+      writer_end = bench_clock::now();
+      b.WriterDone = true;
+    });
+    b.io_service.run();
+    writer.join();
+    cpu_end = std::clock();
+    end = std::max(b.LastEvent, writer_end);
+    events = b.Events;
+    added = b.Added;
+  }
+  boost::filesystem::remove_all(dir);
+
+  double cpu = toMS(cpu_end - cpu_start);
+  std::cout << "files:        " << file_count << "\n"
+            << "events:       " << events << " (" << added << " added)\n"
+            << "unwatched:    " << base_wall << " ms, " << base_cpu
+            << " ms cpu\n"
+            << "watched:      " << toMS(end - start) << " ms, " << cpu
+            << " ms cpu\n"
+            << "lag:          " << toMS(end - writer_end) << " ms\n"
+            << "cpu/event:    " << (cpu - base_cpu) * 1000.0 / events
+            << " us\n";
+  if (added != file_count)
+    std::cout << "warning: " << file_count - added
+              << " added events were lost\n";
+  return 0;
+}
@@ -0,0 +1,137 @@
+//===- tools/endian-bench.cpp - Endian decoding benchmark -------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a benchmark which decodes the fixed size fields of
+// storage entry headers in several ways. On a little endian host read_le
+// should cost the same as a plain load.
+//
+//===----------------------------------------------------------------------===//
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "evelog/Endian.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+namespace {
+// Entries are packed back to back, so the fields are unaligned.
+const std::size_t HeaderSize = 22;
+
+struct Fields {
+  uint16_t ChannelID;
+  uint32_t ThreadID;
+  uint64_t TimeStamp;
+};
+
+template<typename T>
+T loadPlain(const char *p) {
+  T v;
+  std::memcpy(&v, p, sizeof(T));
+  return v;
+}
+
+Fields decodePlain(const char *p) {
+  Fields f;
+  f.ChannelID = loadPlain<uint16_t>(p);
+  f.ThreadID  = loadPlain<uint32_t>(p + 2);
+  f.TimeStamp = loadPlain<uint64_t>(p + 6);
+  return f;
+}
+
+Fields decodeLE(const char *p) {
+  using namespace evelog::endian;
+  Fields f;
+  f.ChannelID = read_le<uint16_t, evelog::unaligned>(p);
+  f.ThreadID  = read_le<uint32_t, evelog::unaligned>(p + 2);
+  f.TimeStamp = read_le<uint64_t, evelog::unaligned>(p + 6);
+  return f;
+}
+
+// The same fields stored big endian, which always need a swap on x86.
+Fields decodeBE(const char *p) {
+  using namespace evelog::endian;
+  Fields f;
+  f.ChannelID = read_be<uint16_t, evelog::unaligned>(p);
+  f.ThreadID  = read_be<uint32_t, evelog::unaligned>(p + 2);
+  f.TimeStamp = read_be<uint64_t, evelog::unaligned>(p + 6);
+  return f;
+}
+
+// Assemble each value a byte at a time, which is correct on any host without
+// knowing its byte order.
+Fields decodeBytes(const char *p) {
+  const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+  Fields f;
+  f.ChannelID = uint16_t(u[0] | (u[1] << 8));
+  f.ThreadID = 0;
+  for (int i = 3; i >= 0; --i)
+    f.ThreadID = (f.ThreadID << 8) | u[2 + i];
+  f.TimeStamp = 0;
+  for (int i = 7; i >= 0; --i)
+    f.TimeStamp = (f.TimeStamp << 8) | u[6 + i];
+  return f;
+}
+
+template<typename Decode>
+double run(const char *name, const std::vector<char> &buffer,
+           std::size_t count, unsigned passes, Decode decode) {
+  uint64_t sum = 0;
+  bench_clock::time_point start = bench_clock::now();
+  for (unsigned pass = 0; pass != passes; ++pass) {
+    const char *p = buffer.data();
+    for (std::size_t i = 0; i != count; ++i, p += HeaderSize) {
+      Fields f = decode(p);
+      sum += f.ChannelID + f.ThreadID + f.TimeStamp;
+    }
+  }
+  double ns = std::chrono::duration<double, std::nano>(
+    bench_clock::now() - start).count();
+  double per_field = ns / (double(count) * passes * 3);
+  std::cout << name << per_field << " ns/field (checksum " << sum << ")\n";
+  return per_field;
+}
+} // end anon namespace.
+
+int main(int argc, char **argv) {
+  // The default buffer fits in cache, so that the decoding is measured and
+  // not the memory bus.
+  std::size_t count = argc > 1 ? std::atoi(argv[1]) : 10000;
+  if (count == 0) {
+    std::cout << "endian-bench [entry count]\n";
+    return 1;
+  }
+  unsigned passes = unsigned(std::max<std::size_t>(1, 50000000 / count));
+
+  std::vector<char> buffer(count * HeaderSize);
+  uint64_t state = 88172645463325252ull;
+  for (std::size_t i = 0; i != buffer.size(); ++i) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    buffer[i] = char(state);
+  }
+
+  std::cout << "host byte order: "
+            << (!evelog::host_endian::is_known ? "unknown at compile time"
+                : evelog::isLittleEndianHost() ? "little endian"
+                : "big endian")
+            << "\n";
+  double plain = run("plain load:   ", buffer, count, passes, decodePlain);
+  double le    = run("read_le:      ", buffer, count, passes, decodeLE);
+  run("read_be:      ", buffer, count, passes, decodeBE);
+  run("byte by byte: ", buffer, count, passes, decodeBytes);
+  std::cout << "read_le / plain load: " << le / plain << "\n";
+  return 0;
+}
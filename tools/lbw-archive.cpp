@@ -0,0 +1,122 @@
+//===- tools/lbw-archive.cpp - Archive and restore lbw files ----*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a tool which converts lbw files to block compressed
+// archives for long term storage, lists them, and restores them.
+//
+//===----------------------------------------------------------------------===//
+
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "evelog/LBWArchive.h"
+#include "evelog/MappedFile.h"
+#include "evelog/StringRef.h"
+
+namespace {
+void print_help() {
+  std::cout << "lbw-archive [--block-size <bytes>] [--level <0-9>]\n"
+"            <input file> [output file]\n"
+"\tConvert a lbw file to an archive. The output defaults to the input\n"
+"\twith a \"z\" suffix (foo.lbw -> foo.lbwz).\n"
+"\n"
+"lbw-archive --list <archive>\n"
+"\tPrint the index of an archive.\n"
+"\n"
+"lbw-archive --extract <archive> <output file>\n"
+"\tRestore the lbw file an archive was made from.\n";
+}
+
+bool write_file(const std::string &path, const std::string &data) {
+  std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+  out.write(data.data(), data.size());
+  out.close();
+  if (!out) {
+    std::remove(path.c_str());
+    std::cerr << "failed to write " << path << "\n";
+    return false;
+  }
+  return true;
+}
+
+int list(const std::string &path) {
+  evelog::LBWArchive archive(path);
+  uint64_t raw = 0, compressed = 0;
+  for (uint64_t b = 0; b != archive.getBlockCount(); ++b) {
+    const evelog::ArchiveBlock &ab = archive.getBlock(b);
+    std::cout << "block " << b << ": storage " << ab.Storage << ", "
+              << ab.EntryCount << " entries, " << ab.RawSize << " -> "
+              << ab.CompressedSize << " bytes, time [" << ab.MinTimeStamp
+              << ", " << ab.MaxTimeStamp << "]\n";
+    raw += ab.RawSize;
+    compressed += ab.CompressedSize;
+  }
+  std::cout << archive.getBlockCount() << " blocks, " << raw << " -> "
+            << compressed << " bytes of entries\n";
+  return 0;
+}
+
+int create(const std::string &in_path, const std::string &out_path,
+           const evelog::ArchiveOptions &opts) {
+  evelog::MappedFile in(in_path);
+  std::ofstream out(out_path.c_str(), std::ios::binary | std::ios::trunc);
+  try {
+    evelog::writeArchive(in.getBuffer(), out, opts);
+  } catch (...) {
+    // Don't leave a partial archive behind.
+    out.close();
+    std::remove(out_path.c_str());
+    throw;
+  }
+  out.close();
+  if (!out) {
+    std::remove(out_path.c_str());
+    std::cerr << "failed to write " << out_path << "\n";
+    return 1;
+  }
+  return 0;
+}
+} // end anon namespace.
+
+int main(int argc, char **argv) {
+  try {
+    if (argc == 3 && evelog::StringRef(argv[1]) == "--list")
+      return list(argv[2]);
+    if (argc == 4 && evelog::StringRef(argv[1]) == "--extract") {
+      evelog::LBWArchive archive(argv[2]);
+      return write_file(argv[3], archive.extract()) ? 0 : 1;
+    }
+
+    evelog::ArchiveOptions opts;
+    int i = 1;
+    for (; i + 1 < argc; i += 2) {
+      evelog::StringRef opt(argv[i]);
+      if (opt == "--block-size")
+        opts.BlockSize = uint32_t(std::strtoul(argv[i + 1], 0, 10));
+      else if (opt == "--level")
+        opts.Level = std::atoi(argv[i + 1]);
+      else
+        break;
+    }
+    if (opts.BlockSize == 0 || opts.Level < 0 || opts.Level > 9 ||
+        argc - i < 1 || argc - i > 2) {
+      print_help();
+      return 1;
+    }
+    std::string in_path = argv[i];
+    return create(in_path, argc - i == 2 ? argv[i + 1] : in_path + "z", opts);
+  } catch (const std::exception &e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+}
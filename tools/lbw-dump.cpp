@@ -12,16 +12,54 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <system_error>
+#include <thread>
+#include <vector>
 
-#ifdef WIN32
-# include <boost/asio.hpp>
-# include <dir-monitor/dir_monitor.hpp>
-#endif
+#include <boost/asio.hpp>
+#include <boost/filesystem.hpp>
+#include <dir-monitor/dir_monitor.hpp>
 
 #include "evelog/StringRef.h"
+#include "evelog/EntryScanner.h"
 #include "evelog/LBWReader.h"
+#include "evelog/LiveStorageReader.h"
+#include "evelog/Parallel.h"
+
+// Print the text of an entry, as measured by the entry scanner. Continuation
+// lines of multi-line messages are indented so that each entry can still be
+// told apart.
+// Write one line of an entry, without the '\r' of a "\r\n" line ending.
+void print_line(evelog::StringRef line) {
+  if (line.endswith("\r"))
+    line = line.substr(0, line.size() - 1);
+  std::cout.write(line.data(), line.size());
+}
+
+void print_text(evelog::StringRef data, evelog::TextShape shape) {
+  evelog::StringRef text = data.substr(0, shape.Size);
+  if (shape.LineCount > 1) {
+    for (uint32_t i = 1; i < shape.LineCount; ++i) {
+      std::pair<evelog::StringRef, evelog::StringRef> line = text.split('\n');
+      print_line(line.first);
+      std::cout << "\n  ";
+      text = line.second;
+    }
+  }
+  print_line(text);
+  std::cout << "\n";
+}
+
+void print_text(evelog::StringRef data) {
+  print_text(data, evelog::scanText(data));
+}
 
 void dump_file(evelog::StringRef file_path) {
   std::ifstream input_file(file_path, std::ios::binary);
@@ -32,15 +70,16 @@ void dump_file(evelog::StringRef file_path) {
   }
 
   try {
-    evelog::Workspace w;
-    input_file >> w;
-    std::cout << w.Name << "\n";
-    for (auto si = w.begin_stores(), se = w.end_stores(); si != se; ++si) {
-      std::cout << si->Name << "\n";
-      for (auto ei = si->begin_entries(), ee = si->end_entries();
-                ei != ee; ++ei) {
-        std::cout << ei->Data << "\n";
-      }
+    // Stream the entries out as they are read instead of loading the whole
+    // workspace first. Each entry is measured by the scanner as it goes.
+    evelog::EntryCursor cursor(input_file);
+    std::cout << cursor.getWorkspace().Name << "\n";
+    evelog::Storage s;
+    evelog::StorageEntry e;
+    while (cursor.nextStorage(s)) {
+      std::cout << s.Name << "\n";
+      while (cursor.nextEntry(e))
+        print_text(e.Data);
     }
   } catch (evelog::parse_error &pe) {
     std::cout << "parse error!!! " << pe.what()
@@ -48,26 +87,352 @@ void dump_file(evelog::StringRef file_path) {
   }
 }
 
-#ifdef WIN32
 boost::asio::io_service io_service;
 boost::asio::dir_monitor dm(io_service);
 
-void create_file_handler(const boost::system::error_code &ec,
-                         const boost::asio::dir_monitor_event &ev) {
-  // Setup the monitor again.
-  dm.async_monitor(create_file_handler);
+// The directory being watched.
+std::string watched_dir;
+bool watch_recursive;
+
+// Readers for the files being watched, keyed by file_key. Each one remembers
+// how far into its file it has read.
+std::map<std::string, std::unique_ptr<evelog::LiveStorageReader>> live_files;
+
+// Get the key of a file in live_files. The monitor names files after the
+// directory as it was given on the command line, so both the monitor and the
+// directory listings are normalized to the same spelling.
+std::string file_key(const std::string &dirname, const std::string &filename) {
+  return (boost::filesystem::path(dirname) / filename).lexically_normal()
+    .string();
+}
+
+void dump_new_entries(const std::string &file_path) {
+  std::unique_ptr<evelog::LiveStorageReader> &reader = live_files[file_path];
+  if (!reader)
+    reader.reset(new evelog::LiveStorageReader(file_path));
+
+  bool had_workspace = reader->hasWorkspace();
+  std::vector<evelog::StorageEntry> entries;
+  try {
+    reader->update(entries);
+  } catch (evelog::parse_error &pe) {
+    std::cout << "parse error!!! " << pe.what()
+              << "\n@" << reader->getOffset() << "\n";
+    live_files.erase(file_path);
+    return;
+  }
+
+  if (!had_workspace && reader->hasWorkspace())
+    std::cout << reader->getWorkspace().Name << "\n";
+  for (auto i = entries.begin(), e = entries.end(); i != e; ++i)
+    print_text(i->Data);
+  std::cout.flush();
+}
+
+// Get the lbw files in dir.
+std::vector<std::string> list_lbw_files(const std::string &dir,
+                                        bool recursive) {
+  std::vector<std::string> paths;
+  boost::system::error_code ec;
+  if (recursive) {
+    for (boost::filesystem::recursive_directory_iterator i(dir, ec), e;
+         !ec && i != e; i.increment(ec))
+      if (i->path().extension() == ".lbw")
+        paths.push_back(i->path().string());
+  } else {
+    for (boost::filesystem::directory_iterator i(dir, ec), e;
+         !ec && i != e; i.increment(ec))
+      if (i->path().extension() == ".lbw")
+        paths.push_back(i->path().string());
+  }
+  if (ec)
+    std::cout << "Failed to list " << dir << ": " << ec.message() << "\n";
+  return paths;
+}
+
+void handle_file_event(const boost::asio::dir_monitor_event &ev);
+void rescan();
+
+typedef std::vector<std::pair<std::string,
+                              std::unique_ptr<evelog::LiveStorageReader>>>
+  backfilled_files;
+
+// Set while the backfill runs. File events are held back meanwhile, as the
+// backfill may not have handed over the reader for the file yet.
+bool backfilling = false;
+std::vector<boost::asio::dir_monitor_event> deferred_events;
+bool deferred_rescan = false;
+
+// Called on the io_service once the backfill is done.
+void finish_backfill(std::shared_ptr<backfilled_files> files) {
+  for (auto i = files->begin(), e = files->end(); i != e; ++i)
+    live_files[i->first] = std::move(i->second);
+  backfilling = false;
+
+  for (auto i = deferred_events.begin(), e = deferred_events.end(); i != e;
+       ++i)
+    handle_file_event(*i);
+  deferred_events.clear();
+  if (deferred_rescan) {
+    deferred_rescan = false;
+    rescan();
+  }
+}
+
+// Dump the lbw files which are already in dir, parsing them on one thread per
+// hardware thread. This runs on its own thread while the io_service keeps
+// draining the monitor, and the readers are handed to the io_service when it
+// is done, so later events for these files only dump what is written after
+// the scan read them.
+//
+// The directory must already be monitored. Anything written after the scan
+// read a file, including files created during the scan, then has an event
+// queued, and nothing is dumped twice or missed.
+void backfill(const std::string &dir, bool recursive) {
+  std::vector<std::string> paths = list_lbw_files(dir, recursive);
+  std::vector<std::unique_ptr<evelog::LiveStorageReader>> readers(paths.size());
+  std::mutex output_mutex;
+
+  evelog::parallelFor(paths.size(), 0, [&](std::size_t i) {
+    std::unique_ptr<evelog::LiveStorageReader> reader(
+      new evelog::LiveStorageReader(paths[i]));
+    std::vector<evelog::StorageEntry> entries;
+    try {
+      reader->update(entries);
+    } catch (evelog::parse_error &pe) {
+      std::lock_guard<std::mutex> lock(output_mutex);
+      std::cout << "parse error!!! " << pe.what()
+                << "\n@" << reader->getOffset() << "\n";
+      return;
+    }
+
+    // Each file is dumped in one piece.
+    std::lock_guard<std::mutex> lock(output_mutex);
+    if (reader->hasWorkspace())
+      std::cout << reader->getWorkspace().Name << "\n";
+    for (auto ei = entries.begin(), ee = entries.end(); ei != ee; ++ei)
+      print_text(ei->Data);
+    readers[i] = std::move(reader);
+  });
+  std::cout.flush();
+
+  std::shared_ptr<backfilled_files> files(new backfilled_files);
+  for (std::size_t i = 0; i != paths.size(); ++i) {
+    if (!readers[i])
+      continue;
+    boost::filesystem::path p(paths[i]);
+    files->push_back(std::make_pair(
+      file_key(p.parent_path().string(), p.filename().string()),
+      std::move(readers[i])));
+  }
+  io_service.post(std::bind(finish_backfill, files));
+}
+
+// A new file is usually created empty and its header written a moment later,
+// and on Windows it can't be opened at all until the writer lets go. Instead
+// of waiting a fixed time, new files are polled, backing off exponentially,
+// until their workspace header has been read. LiveStorageReader rejects data
+// which can't be the start of a workspace, and waits for more otherwise.
+struct pending_open {
+  boost::asio::deadline_timer timer;
+  boost::posix_time::ptime start;
+  boost::posix_time::time_duration delay;
+  unsigned attempts;
+
+  pending_open()
+    : timer(io_service),
+      start(boost::posix_time::microsec_clock::universal_time()),
+      delay(boost::posix_time::milliseconds(1)), attempts(0) {}
+};
+
+const boost::posix_time::time_duration max_open_delay =
+  boost::posix_time::milliseconds(250);
+const boost::posix_time::time_duration open_timeout =
+  boost::posix_time::seconds(30);
+
+std::map<std::string, std::unique_ptr<pending_open>> pending_opens;
+
+// Time from a file being reported as added to its header having been read.
+struct {
+  unsigned count;
+  double total_ms;
+  double max_ms;
+} open_latency;
+
+void poll_open(const std::string &file_path);
 
-  if (ev.type != boost::asio::dir_monitor_event::added) return;
+void on_open_timer(const boost::system::error_code &ec,
+                   const std::string &file_path) {
+  if (ec == boost::asio::error::operation_aborted) return;
+  if (pending_opens.count(file_path))
+    poll_open(file_path);
+}
+
+void poll_open(const std::string &file_path) {
+  pending_open &p = *pending_opens[file_path];
+  ++p.attempts;
+  dump_new_entries(file_path);
+
+  auto reader = live_files.find(file_path);
+  if (reader == live_files.end()) {
+    // Not a lbw file after all.
+    pending_opens.erase(file_path);
+    return;
+  }
+
+  boost::posix_time::time_duration elapsed =
+    boost::posix_time::microsec_clock::universal_time() - p.start;
+  if (reader->second->hasWorkspace()) {
+    double ms = elapsed.total_microseconds() / 1000.0;
+    ++open_latency.count;
+    open_latency.total_ms += ms;
+    open_latency.max_ms = std::max(open_latency.max_ms, ms);
+    std::clog << "opened " << file_path << " in " << ms << " ms, "
+              << p.attempts << " attempts (mean "
+              << open_latency.total_ms / open_latency.count << " ms, max "
+              << open_latency.max_ms << " ms)\n";
+    pending_opens.erase(file_path);
+    return;
+  }
+
+  if (elapsed > open_timeout) {
+    std::cout << "Gave up waiting for " << file_path << "\n";
+    live_files.erase(file_path);
+    pending_opens.erase(file_path);
+    return;
+  }
+
+  p.timer.expires_from_now(p.delay);
+  p.timer.async_wait(std::bind(on_open_timer, std::placeholders::_1,
+                               file_path));
+  p.delay = std::min(p.delay * 2, max_open_delay);
+}
+
+void handle_file_event(const boost::asio::dir_monitor_event &ev) {
   if (!evelog::StringRef(ev.filename).endswith(".lbw")) return;
+  std::string file_path = file_key(ev.dirname, ev.filename);
+
+  switch (ev.type) {
+  case boost::asio::dir_monitor_event::added:
+    // A file found by the backfill may be reported again.
+    if (live_files.count(file_path) && !pending_opens.count(file_path)) {
+      dump_new_entries(file_path);
+      break;
+    }
+    if (!pending_opens.count(file_path))
+      pending_opens[file_path].reset(new pending_open);
+    poll_open(file_path);
+    break;
+  case boost::asio::dir_monitor_event::modified:
+    // The write may have completed a pending header, so try it right away.
+    if (pending_opens.count(file_path))
+      poll_open(file_path);
+    else
+      dump_new_entries(file_path);
+    break;
+  case boost::asio::dir_monitor_event::removed:
+  case boost::asio::dir_monitor_event::renamed_old_name:
+    live_files.erase(file_path);
+    pending_opens.erase(file_path);
+    break;
+  default:
+    break;
+  }
+}
 
-  // HACK: Sleep for 100ms before trying to open the file... This should
-  //       actually poll until it can be opened.
-  boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+// The monitor lost events, so compare the files with what has been read of
+// them instead.
+void rescan() {
+  std::clog << "missed changes, rescanning " << watched_dir << "\n";
+  std::set<std::string> found;
+  std::vector<std::string> paths = list_lbw_files(watched_dir, watch_recursive);
+  for (auto i = paths.begin(), e = paths.end(); i != e; ++i) {
+    boost::filesystem::path p(*i);
+    boost::asio::dir_monitor_event ev(p.parent_path().string(),
+                                      p.filename().string(),
+                                      boost::asio::dir_monitor_event::added);
+    found.insert(file_key(ev.dirname, ev.filename));
+    handle_file_event(ev);
+  }
 
-  std::string file_path = ev.dirname + "\\" + ev.filename;
-  dump_file(file_path);
+  // Forget the files which are gone.
+  for (auto i = live_files.begin(); i != live_files.end();) {
+    if (found.count(i->first)) {
+      ++i;
+      continue;
+    }
+    pending_opens.erase(i->first);
+    i = live_files.erase(i);
+  }
 }
 
+std::vector<boost::asio::dir_monitor_event> file_events;
+
+void file_events_handler(const boost::system::error_code &ec, std::size_t) {
+  if (ec == boost::asio::error::operation_aborted) return;
+  if (ec && ec != boost::asio::error::no_buffer_space) {
+    std::cout << "Failed to watch " << watched_dir << ": " << ec.message()
+              << "\n";
+    return;
+  }
+
+  if (backfilling) {
+    deferred_events.insert(deferred_events.end(), file_events.begin(),
+                           file_events.end());
+    deferred_rescan = deferred_rescan || ec;
+  } else if (ec) {
+    rescan();
+  } else {
+    for (auto i = file_events.begin(), e = file_events.end(); i != e; ++i)
+      handle_file_event(*i);
+  }
+  file_events.clear();
+
+  // Setup the monitor again.
+  dm.async_monitor_batch(file_events, file_events_handler);
+}
+
+int watch_directory(const std::string &dir, bool recursive, bool backfill_dir) {
+  std::cout << "Watching for lbw files in " << dir << "\n";
+  watched_dir = dir;
+  watch_recursive = recursive;
+
+  try {
+    if (recursive)
+      dm.add_directory_recursive(dir);
+    else
+      dm.add_directory(dir);
+  } catch (std::exception &e) {
+    std::cout << "Failed to watch " << dir << ": " << e.what() << "\n";
+    return 1;
+  }
+  // The logserver writes each entry separately, so only wake up once per
+  // burst.
+  dm.set_coalesce_window(boost::posix_time::milliseconds(10));
+  dm.async_monitor_batch(file_events, file_events_handler);
+
+  // The backfill can take a while, so it runs while the io_service reads
+  // the monitor, which would otherwise let the kernel's queue overflow.
+  std::thread backfill_thread;
+  if (backfill_dir) {
+    backfilling = true;
+    try {
+      backfill_thread = std::thread(backfill, dir, recursive);
+    } catch (const std::system_error &) {
+      backfill(dir, recursive);
+    }
+  }
+  try {
+    io_service.run();
+  } catch(...) {
+    std::cout << "Uncaught exception!\n";
+  }
+  if (backfill_thread.joinable())
+    backfill_thread.join();
+  return 0;
+}
+
+#ifdef WIN32
 std::string get_eve_online_directory() {
   HKEY key;
   LONG result = ::RegOpenKeyExA(
@@ -113,12 +478,35 @@ std::string get_eve_online_directory() {
 
 void print_help() {
   std::cout << "lbw-dump [input file]\n"
+"lbw-dump --watch <directory>\n"
+"\tWatch the directory for changes. Each time a lbw file is created or\n"
+"\twritten to, the new entries are dumped. The time it took to read the\n"
+"\theader of each new file is reported on stderr.\n"
+"\n"
+"lbw-dump --watch-recursive <directory>\n"
+"\tLike --watch, but also watch every directory below it, including ones\n"
+"\tcreated later.\n"
+"\n"
+"lbw-dump --backfill --watch[-recursive] <directory>\n"
+"\tFirst dump the lbw files already in the directory, in parallel, then\n"
+"\twatch it.\n"
+"\n"
 "\tWINDOWS ONLY\n"
-"\tIf called without arguments, the EVE Online directory is watched for\n"
-"\tchanges. Each time a file is written it is dumped.\n";
+"\tIf called without arguments, the EVE Online directory is watched.\n";
 }
 
 int main(int argc, char** argv) {
+  bool backfill_dir = argc > 1 && evelog::StringRef(argv[1]) == "--backfill";
+  if (backfill_dir) {
+    --argc;
+    ++argv;
+  }
+
+  if (argc == 3 && evelog::StringRef(argv[1]) == "--watch")
+    return watch_directory(argv[2], false, backfill_dir);
+  if (argc == 3 && evelog::StringRef(argv[1]) == "--watch-recursive")
+    return watch_directory(argv[2], true, backfill_dir);
+
 #ifdef WIN32
   if (argc == 1) {
     std::string eve_path = get_eve_online_directory();
@@ -127,16 +515,7 @@ int main(int argc, char** argv) {
       return 1;
     }
 
-    std::cout << "Watching for lbw files in " << eve_path << "\n";
-
-    dm.add_directory(eve_path);
-    dm.async_monitor(create_file_handler);
-    try {
-      io_service.run();
-    } catch(...) {
-      std::cout << "Uncaught exception!\n";
-    }
-    return 0;
+    return watch_directory(eve_path, false, backfill_dir);
   }
 #endif
 
@@ -0,0 +1,100 @@
+//===- tools/lbw-export.cpp - Export a lbw file as columns ------*- C++ -*-===//
+//
+// evelog
+//
+// This file is distributed under the Simplified BSD License. See LICENSE.TXT
+// for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements a tool which converts a lbw file to a columnar file
+// which can be mapped and scanned with evelog::ColumnarFile.
+//
+//===----------------------------------------------------------------------===//
+
+#include <cstdio>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "evelog/ColumnarFile.h"
+#include "evelog/LBWReader.h"
+
+namespace {
+const char *getEncodingName(evelog::ColumnarFile::Encoding enc) {
+  switch (enc) {
+  case evelog::ColumnarFile::Plain:      return "plain";
+  case evelog::ColumnarFile::Dictionary: return "dictionary";
+  case evelog::ColumnarFile::Delta:      return "delta";
+  }
+  return "unknown";
+}
+
+void printSummary(const evelog::ColumnarFile &cf) {
+  std::cout << "rows:     " << cf.size() << "\n"
+            << "storages: " << cf.getStorageCount() << "\n";
+  for (unsigned c = 0; c != evelog::ColumnarFile::NumColumns; ++c) {
+    evelog::ColumnarFile::ColumnID id = evelog::ColumnarFile::ColumnID(c);
+    const evelog::ColumnarFile::Column &col = cf.getColumn(id);
+    std::cout << "  " << evelog::ColumnarFile::getColumnName(id) << ": "
+              << getEncodingName(col.Enc);
+    if (col.Enc != evelog::ColumnarFile::Plain)
+      std::cout << ", " << col.ValueCount << " values";
+    std::cout << ", " << int(col.CodeWidth) << " byte codes, "
+              << col.Values.size() + col.Codes.size() << " bytes\n";
+  }
+}
+} // end anon namespace.
+
+int main(int argc, char **argv) {
+  if (argc != 2 && argc != 3) {
+    std::cout << "lbw-export <input file> [output file]\n"
+                 "\tConvert a lbw file to a columnar file. The output defaults\n"
+                 "\tto the input with a \"col\" suffix (foo.lbw -> "
+                 "foo.lbwcol).\n";
+    return 1;
+  }
+
+  std::string in_path = argv[1];
+  std::string out_path = argc == 3 ? argv[2] : in_path + "col";
+  // Set while out_path may hold a partial file.
+  bool writing = false;
+
+  try {
+    evelog::Workspace ws;
+    {
+      std::ifstream in(in_path.c_str(), std::ios::binary);
+      if (!in) {
+        std::cerr << "failed to open " << in_path << "\n";
+        return 1;
+      }
+      in >> ws;
+      if (!in) {
+        std::cerr << "failed to read " << in_path << "\n";
+        return 1;
+      }
+    }
+
+    {
+      writing = true;
+      std::ofstream out(out_path.c_str(), std::ios::binary | std::ios::trunc);
+      evelog::writeColumnarFile(ws, out);
+      out.close();
+      if (!out) {
+        std::remove(out_path.c_str());
+        std::cerr << "failed to write " << out_path << "\n";
+        return 1;
+      }
+      writing = false;
+    }
+
+    printSummary(evelog::ColumnarFile(out_path));
+  } catch (const std::exception &e) {
+    if (writing)
+      std::remove(out_path.c_str());
+    std::cerr << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}